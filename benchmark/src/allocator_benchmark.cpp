@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <chrono>
+#include <vector>
+#include "engine/renderer/tlsf.h"
+
+/*
+* Times the tlsf sub-allocator against the linear scan the allocator used before.
+* Nothing is allocated on the device. Both allocators only hand out offsets into a fake VkDeviceMemory
+*/
+
+static const VkDeviceMemory FAKE_MEMORY = (VkDeviceMemory)(uintptr_t)0x1000;
+static const VkDeviceSize MEMORY_SIZE = 256ull * 1024 * 1024;
+static const VkDeviceSize ALIGNMENT = 256;
+
+struct allocation {
+	VkDeviceMemory memory;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	tlsf::block_handle block;
+};
+
+// the old allocator: sorted list of used ranges, first fit by walking the gaps between them
+class linear_allocator {
+public:
+	explicit linear_allocator(VkDeviceSize size) : m_size(size) {}
+
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, allocation* out) {
+		for (size_t i = 0; i <= m_blocks.size(); i++) {
+			VkDeviceSize start = i == 0 ? 0 : m_blocks[i - 1].offset + m_blocks[i - 1].size;
+			VkDeviceSize end = i == m_blocks.size() ? m_size : m_blocks[i].offset;
+			start = (start + alignment - 1) / alignment * alignment;
+			if (start + size <= end) {
+				m_blocks.insert(m_blocks.begin() + i, range{ start, size });
+				*out = allocation{ FAKE_MEMORY, start, size, NULL };
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void free(const allocation& allocation) {
+		for (auto it = m_blocks.begin(); it != m_blocks.end(); it++) {
+			if (it->offset == allocation.offset) {
+				m_blocks.erase(it);
+				return;
+			}
+		}
+		assert(false);
+	}
+
+private:
+	struct range {
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	VkDeviceSize m_size;
+	std::vector<range> m_blocks;
+};
+
+class tlsf_allocator {
+public:
+	explicit tlsf_allocator(VkDeviceSize size) { m_blocks.initialize(size); }
+
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, allocation* out) {
+		tlsf::block_handle block = m_blocks.allocate(size, alignment);
+		if (block == NULL)
+			return false;
+		*out = allocation{ FAKE_MEMORY, tlsf::offset(block), size, block };
+		return true;
+	}
+
+	void free(const allocation& allocation) {
+		m_blocks.free(allocation.block);
+	}
+
+private:
+	tlsf m_blocks;
+};
+
+// small deterministic generator so both allocators see the same sequence
+static uint32_t next_random(uint32_t* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// mostly small buffers with the occasional large image
+static VkDeviceSize random_size(uint32_t* state) {
+	uint32_t r = next_random(state);
+	if (r % 64 == 0)
+		return 64 * 1024 + r % (1024 * 1024);
+	return 64 + r % (16 * 1024);
+}
+
+struct result {
+	double milliseconds;
+	size_t operations;
+	size_t failed;
+};
+
+// fills the memory with live allocations, then keeps freeing a random one and allocating a new one
+template<typename A>
+static result run(uint32_t live_count, uint32_t iteration_count) {
+	A allocator(MEMORY_SIZE);
+	std::vector<allocation> live;
+	live.reserve(live_count);
+	uint32_t state = 0x9E3779B9;
+	result r = {};
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < live_count; i++) {
+		allocation a;
+		if (allocator.allocate(random_size(&state), ALIGNMENT, &a))
+			live.push_back(a);
+		else
+			r.failed++;
+		r.operations++;
+	}
+
+	for (uint32_t i = 0; i < iteration_count && !live.empty(); i++) {
+		size_t index = next_random(&state) % live.size();
+		allocator.free(live[index]);
+		live[index] = live.back();
+		live.pop_back();
+
+		allocation a;
+		if (allocator.allocate(random_size(&state), ALIGNMENT, &a))
+			live.push_back(a);
+		else
+			r.failed++;
+		r.operations += 2;
+	}
+
+	for (const allocation& a : live)
+		allocator.free(a);
+	r.operations += live.size();
+	auto end = std::chrono::steady_clock::now();
+
+	r.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return r;
+}
+
+static void print(const char* name, const result& r) {
+	printf("  %-8s %10.3f ms %8.1f ns/op  (%zu failed)\n", name, r.milliseconds,
+		r.milliseconds * 1000000.0 / (double)r.operations, r.failed);
+}
+
+int main(int argc, char** argv) {
+	uint32_t iteration_count = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+	const uint32_t live_counts[] = { 100, 1000, 5000, 10000 };
+
+	printf("%d MiB fake device memory, %d byte alignment, %u free/allocate pairs\n",
+		(int)(MEMORY_SIZE / (1024 * 1024)), (int)ALIGNMENT, iteration_count);
+	for (uint32_t live_count : live_counts) {
+		printf("%u live allocations\n", live_count);
+		print("linear", run<linear_allocator>(live_count, iteration_count));
+		print("tlsf", run<tlsf_allocator>(live_count, iteration_count));
+	}
+	return 0;
+}
@@ -11,25 +11,30 @@ bool application::create() {
 	if (!render_api::init())
 		return false;
 
-	m_rendering_context= context::create_context(m_window->get_handle());
+	m_rendering_context= context::create_context(m_window->get_handle(), m_frames_in_flight);
 	if (m_rendering_context == NULL)
 		return false;
 
 	m_rendering_context->make_context_current();
-	m_finished_rendering = create_semaphore();
-	if (m_finished_rendering == VK_NULL_HANDLE)
+
+	m_staging_buffer = staging_buffer::create();
+	if (m_staging_buffer == NULL)
+		return false;
+	m_uniform_ring = uniform_ring::create();
+	if (m_uniform_ring == NULL)
+		return false;
+	if (!m_profiler.initialize(context::get_frames_in_flight()))
 		return false;
+	if (!m_command_allocator.initialize(context::get_frames_in_flight(), m_thread_pool.thread_count()))
+		return false;
+	m_graphics_batch.set_queue(context::get_graphics_queue());
 
 	if (!on_create())
 		return false;
 	
-	if (m_render_pass == VK_NULL_HANDLE) {
-		err("The client did not create a render pass!\n");
+	// clients without a render pass render into context::get_current_image_view with dynamic rendering
+	if (!context::create_window_framebuffers(m_render_pass, m_depth_format))
 		return false;
-	}
-	m_command_buffers = new command_buffer[context::get_swapchain().image_count];
-
-	context::create_window_framebuffers(m_render_pass);
 
 	return true;
 }
@@ -38,27 +43,75 @@ bool application::create() {
 bool application::update(float delta_time) {
 	bool success = true;
 
-	uint32_t image_index;
-	if (context::begin_frame(&image_index) == VK_TIMEOUT)
+	m_profiler.new_frame(context::current_frame_index());
+	VkResult res;
+	{
+		profiler::cpu_scope scope(m_profiler, "begin_frame");
+		res = context::begin_frame(NULL);
+	}
+	if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+		// skip the frame. The next one acquires an image of the new swapchain
+		while (m_window->is_minimized() && !m_window->is_closed_requsted())
+			m_window->wait_events();
+		context::recreate_swapchain(m_render_pass, m_depth_format);
+		return true;
+	}
+	if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
 		return false;
 
-	command_buffer& cmd_buf = m_command_buffers[image_index];
-	if (cmd_buf.reset() != VK_SUCCESS) {
-		err("Failed to reset command buffer\n");
+	context::get_memory_allocator().release_unused_blocks();
+
+	// the fence of this frame has signaled, so the pools of the frame can be reset as a whole
+	if (!m_command_allocator.begin_frame(context::current_frame_index()))
+		err("Failed to reset the frame command pools\n");
+	m_uniform_ring->begin_frame();
+	command_buffer cmd_buf = m_command_allocator.allocate();
+	if (cmd_buf.get_handle() == VK_NULL_HANDLE) {
+		err("Failed to allocate the frame command buffer\n");
+		return false;
 	}
 
-	cmd_buf.start();
-	success &= on_update(cmd_buf, delta_time);
+	cmd_buf.start(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	m_profiler.begin_gpu_frame(cmd_buf);
+	{
+		profiler::cpu_scope scope(m_profiler, "on_update");
+		success &= on_update(cmd_buf, delta_time);
+	}
+	m_profiler.end_gpu_frame(cmd_buf);
 	cmd_buf.end();
 	
+	{
+		profiler::cpu_scope scope(m_profiler, "submit");
+		// the uploads are submitted first, so the frame sees them
+		if (!m_staging_buffer->flush()) {
+			err("Failed to submit uploads\n");
+			success = false;
+		}
+		m_uniform_ring->end_frame();
+		// only the writes to the swapchain image have to wait for the image to be acquired
+		m_graphics_batch.begin_submission();
+		m_graphics_batch.add_wait(context::get_acquired_semaphore(), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		m_graphics_batch.add_command_buffer(cmd_buf.get_handle());
+		m_graphics_batch.add_signal(context::get_render_finished_semaphore());
+		// objects that were used by this frame are destroyed once the timeline reaches its value
+		gpu_timeline& timeline = context::get_graphics_timeline();
+		m_graphics_batch.add_signal(timeline.get_handle(), timeline.signal_next());
+		if (m_graphics_batch.flush(context::get_in_flight_fence()) != VK_SUCCESS) {
+			err("Failed to submit the frame\n");
+			success = false;
+		}
+	}
 	
-	cmd_buf.submit(context::get_graphics_queue(), context::get_acquired_semaphore(), m_finished_rendering, context::get_in_flight_fence(), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-	
-	if (context::end_frame(m_finished_rendering) == VK_ERROR_OUT_OF_DATE_KHR) {
+	{
+		profiler::cpu_scope scope(m_profiler, "end_frame");
+		res = context::end_frame(context::get_render_finished_semaphore());
+	}
+	if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR) {
 		while (m_window->is_minimized() && !m_window->is_closed_requsted())
 			m_window->wait_events();
-		context::recreate_swapchain(m_render_pass);
+		context::recreate_swapchain(m_render_pass, m_depth_format);
 	}
+	m_profiler.end_frame();
 
 
 	return success;
@@ -66,12 +119,15 @@ bool application::update(float delta_time) {
 
 bool application::start() {
 	m_running = true;
-	auto prev = std::chrono::high_resolution_clock::now();
+	auto prev = std::chrono::steady_clock::now();
 
-	m_app_start_time = std::chrono::high_resolution_clock::now();
+	m_app_start_time = std::chrono::steady_clock::now();
 	
+	uint64_t frame_count = 0;
 	while (m_running && !m_window->is_closed_requsted()) {
-		auto now = std::chrono::high_resolution_clock::now();
+		if (m_frame_limit != 0 && frame_count++ >= m_frame_limit)
+			break;
+		auto now = std::chrono::steady_clock::now();
 		float delta_time = 1e-6f * std::chrono::duration_cast<std::chrono::microseconds>(now - prev).count();
 		prev = now;
 
@@ -87,16 +143,19 @@ bool application::start() {
 }
 
 void application::terminate() {
+	// jobs may still record into the command pools of the workers and use the context
+	m_thread_pool.shutdown();
 	vkDeviceWaitIdle(context::get_device());
 	on_terminate();
+	if (m_staging_buffer)
+		m_staging_buffer->destroy();
+	m_staging_buffer = NULL;
+	if (m_uniform_ring)
+		m_uniform_ring->destroy();
+	m_uniform_ring = NULL;
+	m_profiler.destroy();
+	m_command_allocator.destroy();
 
-	for (uint32_t i = 0; i < context::get_swapchain().image_count; i++) {
-		m_command_buffers[i].destroy();
-	}
-
-	delete[] m_command_buffers;
-
-	vkDestroySemaphore(m_rendering_context->device(), m_finished_rendering, NULL);
 	delete m_rendering_context;
 	render_api::shutdown();
 
@@ -107,6 +166,6 @@ void application::terminate() {
 	}
 }
 float application::get_time() const {
-	auto now = std::chrono::high_resolution_clock::now();
+	auto now = std::chrono::steady_clock::now();
 	return 1e-6f * std::chrono::duration_cast<std::chrono::microseconds>(now - m_app_start_time).count();
 }
\ No newline at end of file
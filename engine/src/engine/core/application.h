@@ -4,6 +4,11 @@
 #include "window.h"
 #include "engine/renderer/context.h"
 #include "engine/renderer/command_buffer.h"
+#include "engine/renderer/command_allocator.h"
+#include "engine/renderer/submit_batch.h"
+#include "engine/renderer/buffer.h"
+#include "engine/renderer/profiler.h"
+#include "thread_pool.h"
 #include <chrono>
 
 class application {
@@ -16,7 +21,27 @@ public:
 
 	float get_time() const;
 protected:
+	// window framebuffers are created for this render pass. Stays VK_NULL_HANDLE for dynamic rendering
 	VkRenderPass m_render_pass = VK_NULL_HANDLE;
+	// the context creates a depth image of this format with the window framebuffers, see find_depth_format.
+	// Set in on_create. VK_FORMAT_UNDEFINED for no depth
+	VkFormat m_depth_format = VK_FORMAT_UNDEFINED;
+	// uploads recorded here are submitted once per frame before the frame itself
+	std::shared_ptr<staging_buffer> m_staging_buffer;
+	// per draw uniform data of the current frame, bound with dynamic offsets
+	std::shared_ptr<uniform_ring> m_uniform_ring;
+	// times begin_frame, on_update, submit and end_frame. Clients can add their own cpu and gpu scopes
+	profiler m_profiler;
+	// workers for parallel jobs like pipeline compilation and command recording
+	thread_pool m_thread_pool;
+	// command buffers that are only used for the current frame, the primary and the secondaries recorded by the workers
+	command_allocator m_command_allocator;
+	// submissions to the graphics queue added by on_update run before the frame and are submitted together with it
+	submit_batch m_graphics_batch;
+	// number of frames the cpu may record while the gpu still works on older ones. Set before the application is created
+	uint32_t m_frames_in_flight = 2;
+	// the application stops after this many frames. 0 runs until the window is closed, which never happens headless
+	uint64_t m_frame_limit = 0;
 	bool m_running;
 private:
 
@@ -26,15 +51,11 @@ private:
 	void terminate();
 
 
-	VkSemaphore m_finished_rendering;
-
 	std::chrono::steady_clock::time_point m_app_start_time;
 
 	window* m_window;
 	context* m_rendering_context;
 
-	command_buffer* m_command_buffers;
-
 	friend int main(const int, const char**);
 };
 
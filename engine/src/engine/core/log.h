@@ -17,4 +17,11 @@
 #endif
 #define err(...) fprintf(stderr, LOG_PREFIX "ERROR:\t" __VA_ARGS__)
 
+// a trap without an attached debugger kills the process. Linux builds also run headless without one, so they only log
+#ifdef _MSC_VER
+#define debug_break() __debugbreak()
+#else
+#define debug_break() ((void)0)
+#endif
+
 #endif //ENGINE_CORE_LOG_H
\ No newline at end of file
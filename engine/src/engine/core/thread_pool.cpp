@@ -0,0 +1,50 @@
+#include "thread_pool.h"
+
+static thread_local uint32_t s_worker_index = thread_pool::NOT_A_WORKER;
+
+thread_pool::thread_pool(uint32_t thread_count) {
+	if (thread_count == 0) {
+		uint32_t cores = std::thread::hardware_concurrency();
+		thread_count = cores > 1 ? cores - 1 : 1;
+	}
+	m_workers.reserve(thread_count);
+	for (uint32_t i = 0; i < thread_count; i++)
+		m_workers.emplace_back(&thread_pool::run, this, i);
+}
+
+thread_pool::~thread_pool() {
+	shutdown();
+}
+
+void thread_pool::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_job_available.notify_all();
+	// the workers finish all queued jobs before they exit
+	for (std::thread& worker : m_workers) {
+		if (worker.joinable())
+			worker.join();
+	}
+}
+
+uint32_t thread_pool::worker_index() {
+	return s_worker_index;
+}
+
+void thread_pool::run(uint32_t index) {
+	s_worker_index = index;
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_job_available.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+			if (m_jobs.empty())
+				return;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
@@ -0,0 +1,63 @@
+#ifndef ENGINE_CORE_THREAD_POOL_H
+#define ENGINE_CORE_THREAD_POOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+/*
+* Fixed number of worker threads that execute jobs in submission order.
+* Every worker knows its index, which lets jobs use per thread resources like command pools.
+*/
+class thread_pool {
+public:
+	static constexpr uint32_t NOT_A_WORKER = 0xFFFFFFFF;
+
+	// 0 uses one thread per core except for the calling thread
+	explicit thread_pool(uint32_t thread_count = 0);
+	~thread_pool();
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	template<typename F>
+	auto submit(F&& job) -> std::future<decltype(job())>;
+
+	// runs the queued jobs to completion and joins the workers. Jobs submitted afterwards never run
+	void shutdown();
+
+	uint32_t thread_count() const { return (uint32_t)m_workers.size(); }
+
+	// index of the calling worker in [0, thread_count()) or NOT_A_WORKER if called from another thread
+	static uint32_t worker_index();
+
+private:
+	void run(uint32_t index);
+
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_job_available;
+	bool m_stopping = false;
+};
+
+template<typename F>
+auto thread_pool::submit(F&& job) -> std::future<decltype(job())> {
+	using result_type = decltype(job());
+	// std::function has to be copyable, the task is not
+	auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(job));
+	std::future<result_type> result = task->get_future();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.emplace_back([task]() { (*task)(); });
+	}
+	m_job_available.notify_one();
+	return result;
+}
+
+#endif //ENGINE_CORE_THREAD_POOL_H
@@ -4,6 +4,7 @@
 
 #include "core/application.h"
 #include "core/window.h"
+#include "core/thread_pool.h"
 
 
 #include "renderer/render_api.h"
@@ -13,9 +14,18 @@
 #include "renderer/shader.h"
 #include "renderer/framebuffer.h"
 #include "renderer/command_buffer.h"
+#include "renderer/command_allocator.h"
+#include "renderer/submit_batch.h"
 #include "renderer/synchronization.h"
 #include "renderer/buffer.h"
 #include "renderer/memory.h"
+#include "renderer/image.h"
+#include "renderer/profiler.h"
+#include "renderer/descriptor.h"
+#include "renderer/culling_pass.h"
+#include "renderer/render_graph.h"
+#include "renderer/gpu_timeline.h"
+#include "renderer/deletion_queue.h"
 
 
 #define stack_array_len(arr) (sizeof(arr) / sizeof(arr[0]))
@@ -1,6 +1,8 @@
 #include "buffer.h"
 #include "context.h"
+#include "synchronization.h"
 #include <assert.h>
+#include <algorithm>
 
 
 
@@ -31,10 +33,12 @@ bool create_buffer(buffer_info& info, size_t capacity, VkBufferUsageFlags usage,
 	if (capacity < info.memory_requirements.size)
 		capacity = info.memory_requirements.size;
 
-	// allocate memory
+	// allocate memory. The placement honours the alignment the buffer requires
 	allocator& allocator = context::get_memory_allocator();
 	allocator::access_flags access = host_visible ? allocator::access_flags::DYNAMIC : allocator::access_flags::STATIC;
-	allocator::sub_allocation sub_allocation = allocator.allocate(capacity, info.memory_requirements.memoryTypeBits, access);
+	VkMemoryRequirements requirements = info.memory_requirements;
+	requirements.size = capacity;
+	allocator::sub_allocation sub_allocation = allocator.allocate(requirements, access, allocator::tiling::LINEAR);
 
 
 	// check for allocation errors
@@ -73,31 +77,36 @@ std::shared_ptr<vertex_buffer> vertex_buffer::create() {
 	return std::make_shared<vertex_buffer>();
 }
 
+void destroy_buffer(buffer_info& info) {
+	if (info.handle == VK_NULL_HANDLE && !info.memory)
+		return;
+	VkBuffer handle = info.handle;
+	allocator::sub_allocation memory = info.memory;
+	context::defer_destruction([handle, memory]() {
+		if (handle != VK_NULL_HANDLE)
+			vkDestroyBuffer(context::get_device(), handle, NULL);
+		if (memory)
+			context::get_memory_allocator().free(memory);
+	});
+	info.memory = allocator::invalid_allocation;
+	info.handle = VK_NULL_HANDLE;
+	info.capacity = 0;
+}
+
 void vertex_buffer::destroy() {
-	if(m_info.handle != VK_NULL_HANDLE)
-		vkDestroyBuffer(context::get_device(), m_info.handle, NULL);
-	allocator& allocator = context::get_memory_allocator();
-	if (m_info.memory)
-		allocator.free(m_info.memory);
-	m_info.memory = allocator::invalid_allocation;
-	m_info.handle = VK_NULL_HANDLE;
-	m_info.capacity = 0;
+	// frames in flight may still read the buffer
+	destroy_buffer(m_info);
 }
 
 void index_buffer::destroy() {
-	if (m_info.handle != VK_NULL_HANDLE)
-		vkDestroyBuffer(context::get_device(), m_info.handle, NULL);
-	allocator& allocator = context::get_memory_allocator();
-	if (m_info.memory)
-		allocator.free(m_info.memory);
-	m_info.memory = allocator::invalid_allocation;
-	m_info.handle = VK_NULL_HANDLE;
-	m_info.capacity = 0;
+	destroy_buffer(m_info);
 }
 
 
 
-bool vertex_buffer::set_buffer_data(command_buffer& cmd_buf, std::shared_ptr<staging_buffer> staging, const void* data, size_t n_bytes) {
+bool vertex_buffer::set_buffer_data(std::shared_ptr<staging_buffer> staging, const void* data, size_t n_bytes) {
+	// a buffer that is kept may still be read by frames in flight
+	bool in_use = m_info.capacity >= n_bytes && m_size > 0;
 	// (re)allocate buffer
 	if(m_info.capacity < n_bytes) {
 		// clean up old memory
@@ -110,11 +119,15 @@ bool vertex_buffer::set_buffer_data(command_buffer& cmd_buf, std::shared_ptr<sta
 	}
 
 	// memcpy host to device
-	staging->cpy(cmd_buf, m_info.handle, 0, data, n_bytes);
+	bool copied = in_use ? staging->update(m_info.handle, 0, data, n_bytes) : staging->cpy(m_info.handle, 0, data, n_bytes);
+	if (!copied)
+		return false;
 	m_size = n_bytes;
 	return true;
 }
-bool index_buffer::set_buffer_data(command_buffer& cmd_buf, std::shared_ptr<staging_buffer> staging, const uint32_t* indices, size_t n_bytes) {
+bool index_buffer::set_buffer_data(std::shared_ptr<staging_buffer> staging, const uint32_t* indices, size_t n_bytes) {
+	// a buffer that is kept may still be read by frames in flight
+	bool in_use = m_info.capacity >= n_bytes && m_size > 0;
 	// (re)allocate buffer
 	if (m_info.capacity < n_bytes) {
 		// clean up old memory
@@ -128,50 +141,541 @@ bool index_buffer::set_buffer_data(command_buffer& cmd_buf, std::shared_ptr<stag
 
 
 	// memcpy host to device
-	staging->cpy(cmd_buf, m_info.handle, 0, indices, n_bytes);
+	bool copied = in_use ? staging->update(m_info.handle, 0, indices, n_bytes) : staging->cpy(m_info.handle, 0, indices, n_bytes);
+	if (!copied)
+		return false;
 	m_size = n_bytes;
 	return true;
 }
 
-std::shared_ptr<staging_buffer> staging_buffer::create() {
+bool vertex_buffer::update_buffer_data(std::shared_ptr<staging_buffer> staging, size_t offset, const void* data, size_t n_bytes) {
+	if (offset + n_bytes > m_size)
+		return false;
+	return staging->update(m_info.handle, offset, data, n_bytes);
+}
+bool index_buffer::update_buffer_data(std::shared_ptr<staging_buffer> staging, size_t offset, const uint32_t* indices, size_t n_bytes) {
+	if (offset + n_bytes > m_size)
+		return false;
+	return staging->update(m_info.handle, offset, indices, n_bytes);
+}
+
+std::shared_ptr<instance_buffer> instance_buffer::create() {
+	return std::make_shared<instance_buffer>();
+}
+
+void instance_buffer::destroy() {
+	destroy_buffer(m_info);
+	m_instance_count = 0;
+}
+
+bool instance_buffer::set_buffer_data(std::shared_ptr<staging_buffer> staging, const void* instances, uint32_t instance_count, uint32_t instance_size) {
+	size_t n_bytes = (size_t)instance_count * instance_size;
+	// a buffer that is kept may still be read by frames in flight
+	bool in_use = m_info.capacity >= n_bytes && m_instance_count > 0;
+	if (m_info.capacity < n_bytes) {
+		if (m_info.handle)
+			destroy();
+		if (!create_buffer(m_info, n_bytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false))
+			return false;
+	}
+
+	bool copied = in_use ? staging->update(m_info.handle, 0, instances, n_bytes) : staging->cpy(m_info.handle, 0, instances, n_bytes);
+	if (!copied)
+		return false;
+	m_instance_count = instance_count;
+	m_instance_size = instance_size;
+	return true;
+}
+
+bool instance_buffer::update_buffer_data(std::shared_ptr<staging_buffer> staging, uint32_t first_instance, const void* instances, uint32_t instance_count) {
+	if ((uint64_t)first_instance + instance_count > m_instance_count)
+		return false;
+	return staging->update(m_info.handle, (VkDeviceAddress)first_instance * m_instance_size, instances, (VkDeviceSize)instance_count * m_instance_size);
+}
+
+std::shared_ptr<indirect_buffer> indirect_buffer::create() {
+	return std::make_shared<indirect_buffer>();
+}
+
+void indirect_buffer::destroy() {
+	destroy_buffer(m_info);
+	m_max_draws = 0;
+	m_draw_count = 0;
+}
+
+bool indirect_buffer::reserve(uint32_t max_draws) {
+	if (max_draws <= m_max_draws)
+		return true;
+	if (m_info.handle)
+		destroy();
+	size_t n_bytes = COMMANDS_OFFSET + (size_t)max_draws * sizeof(VkDrawIndexedIndirectCommand);
+	if (!create_buffer(m_info, n_bytes, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false))
+		return false;
+	m_max_draws = max_draws;
+	return true;
+}
+
+bool indirect_buffer::set_commands(std::shared_ptr<staging_buffer> staging, const VkDrawIndexedIndirectCommand* commands, uint32_t count) {
+	// frames in flight may still draw from a buffer that is kept
+	bool in_use = m_info.handle != VK_NULL_HANDLE && count <= m_max_draws;
+	if (!reserve(count))
+		return false;
+	auto copy = [&](VkDeviceAddress offset, const void* data, VkDeviceSize size) {
+		return in_use ? staging->update(m_info.handle, offset, data, size) : staging->cpy(m_info.handle, offset, data, size);
+	};
+	if (count > 0 && !copy(COMMANDS_OFFSET, commands, (VkDeviceSize)count * sizeof(VkDrawIndexedIndirectCommand)))
+		return false;
+	if (!copy(COUNT_OFFSET, &count, sizeof(count)))
+		return false;
+	m_draw_count = count;
+	return true;
+}
+
+void indirect_buffer::draw(command_buffer& cmd_buf) const {
+	if (m_draw_count == 0)
+		return;
+	constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	if (m_draw_count == 1 || context::get_device_features().multi_draw_indirect) {
+		vkCmdDrawIndexedIndirect(cmd_buf.get_handle(), m_info.handle, COMMANDS_OFFSET, m_draw_count, stride);
+		return;
+	}
+	for (uint32_t i = 0; i < m_draw_count; i++)
+		vkCmdDrawIndexedIndirect(cmd_buf.get_handle(), m_info.handle, COMMANDS_OFFSET + (VkDeviceSize)i * stride, 1, stride);
+}
+
+void indirect_buffer::draw_count(command_buffer& cmd_buf) const {
+	assert(context::get_device_features().draw_indirect_count);
+	if (m_max_draws == 0)
+		return;
+	vkCmdDrawIndexedIndirectCount(cmd_buf.get_handle(), m_info.handle, COMMANDS_OFFSET, m_info.handle, COUNT_OFFSET, m_max_draws, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+std::shared_ptr<staging_buffer> staging_buffer::create(size_t capacity) {
 
 	std::shared_ptr<staging_buffer> staging = std::make_shared<staging_buffer>();
-	size_t n_bytes = 1 << 20;
-	if (!create_buffer(staging->m_info, n_bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true))
+	if (capacity > staging->m_max_size)
+		staging->m_max_size = capacity;
+	if (!create_buffer(staging->m_info, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true))
 		return NULL;
 
-	staging->m_size = n_bytes;
+	staging->m_size = capacity;
 
 	return staging;
 }
 
 void staging_buffer::destroy() {
-	if (m_info.handle != VK_NULL_HANDLE)
-		vkDestroyBuffer(context::get_device(), m_info.handle, NULL);
+	VkDevice device = context::get_device();
+	if (device == VK_NULL_HANDLE)
+		return;
+
+	// the copies have to finish before their source memory goes away
+	for (submission* sub : m_in_flight) {
+		vkWaitForFences(device, 1, &sub->fence, VK_TRUE, UINT64_MAX);
+		m_unused.push_back(sub);
+	}
+	m_in_flight.clear();
+	if (m_current) {
+		m_current->copies.clear();
+		m_current->updates.clear();
+		m_unused.push_back(m_current);
+		m_current = NULL;
+	}
+	for (submission* sub : m_unused) {
+		sub->cmd_buf.destroy();
+		sub->graphics_cmd_buf.destroy();
+		vkDestroySemaphore(device, sub->copies_finished, NULL);
+		vkDestroyFence(device, sub->fence, NULL);
+		delete sub;
+	}
+	m_unused.clear();
+
 	allocator& allocator = context::get_memory_allocator();
+	for (retired_buffer& retired : m_retired) {
+		vkDestroyBuffer(device, retired.info.handle, NULL);
+		allocator.free(retired.info.memory);
+	}
+	m_retired.clear();
+
+	if (m_info.handle != VK_NULL_HANDLE)
+		vkDestroyBuffer(device, m_info.handle, NULL);
 	if (m_info.memory)
 		allocator.free(m_info.memory);
 	m_info.memory = allocator::invalid_allocation;
 	m_info.handle = VK_NULL_HANDLE;
 	m_info.capacity = 0;
+	m_size = 0;
+	m_head = 0;
+	m_tail = 0;
+}
+
+bool staging_buffer::cpy(VkBuffer dest, VkDeviceAddress offset, const void* data, VkDeviceSize size) {
+	return stage(dest, offset, data, size, false);
+}
+
+bool staging_buffer::update(VkBuffer dest, VkDeviceAddress offset, const void* data, VkDeviceSize size) {
+	return stage(dest, offset, data, size, true);
 }
 
-bool staging_buffer::cpy(command_buffer& cmd_buf, VkBuffer dest, VkDeviceAddress offset, const void* data, VkDeviceSize size) {
-	if (size == 0)
+bool staging_buffer::stage(VkBuffer dest, VkDeviceAddress offset, const void* data, VkDeviceSize size, bool graphics_queue) {
+	const char* src = (const char*)data;
+	while (size > 0) {
+		// a chunk never takes more than half of the largest ring, so it always fits once the ring has drained
+		VkDeviceSize chunk = size;
+		if (chunk > m_max_size / 2)
+			chunk = m_max_size / 2;
+
+		VkDeviceSize src_offset;
+		if (!allocate(chunk, &src_offset))
+			return false;
+		if (!begin_submission())
+			return false;
+		if (!memory::memcpy_host_to_device(m_info.memory, src_offset, src, chunk))
+			return false;
+
+		pending_copy& cpy = graphics_queue ? m_current->updates.emplace_back() : m_current->copies.emplace_back();
+		cpy.dest = dest;
+		cpy.region.srcOffset = src_offset;
+		cpy.region.dstOffset = offset;
+		cpy.region.size = chunk;
+
+		src += chunk;
+		offset += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+staging_buffer::submission::submission() : cmd_buf(context::get_transfer_command_pool()), graphics_cmd_buf(context::get_command_pool()),
+		copies_finished(VK_NULL_HANDLE), fence(VK_NULL_HANDLE), ring_end(0), id(0) { }
+
+bool staging_buffer::begin_submission() {
+	if (m_current)
+		return true;
+
+	submission* sub;
+	if (m_unused.empty()) {
+		sub = new submission;
+		sub->fence = create_fence();
+		sub->copies_finished = create_semaphore();
+		if (sub->fence == VK_NULL_HANDLE || sub->copies_finished == VK_NULL_HANDLE) {
+			m_unused.push_back(sub);
+			return false;
+		}
+	}else {
+		sub = m_unused.back();
+		m_unused.pop_back();
+	}
+
+	// the command buffers are recorded in submit, once it is known which queues are needed
+	m_current = sub;
+	return true;
+}
+
+bool staging_buffer::flush() {
+	if (m_current == NULL)
 		return true;
-	if (m_size < m_offset + size)
+	submission* sub = m_current;
+	m_current = NULL;
+
+	sub->ring_end = m_head;
+	sub->id = m_next_submission_id++;
+	if (!submit(sub)) {
+		sub->cmd_buf.reset();
+		sub->graphics_cmd_buf.reset();
+		sub->copies.clear();
+		sub->updates.clear();
+		sub->destinations.clear();
+		m_unused.push_back(sub);
 		return false;
-	if (!memory::memcpy_host_to_device(m_info.memory, m_offset, data, size))
+	}
+	m_in_flight.push_back(sub);
+	return true;
+}
+
+// records one vkCmdCopyBuffer per destination. Regions of one command must not overlap,
+// so a region that overlaps an earlier one of the same destination starts a new command after a barrier
+void staging_buffer::record_copies(command_buffer& cmd_buf, std::vector<pending_copy>& copies, std::vector<VkBuffer>* destinations) {
+	std::stable_sort(copies.begin(), copies.end(), [](const pending_copy& a, const pending_copy& b) { return a.dest < b.dest; });
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	std::vector<VkBufferCopy> regions;
+	size_t i = 0;
+	while (i < copies.size()) {
+		VkBuffer dest = copies[i].dest;
+		if (destinations)
+			destinations->push_back(dest);
+
+		for (; i < copies.size() && copies[i].dest == dest; i++) {
+			const VkBufferCopy& region = copies[i].region;
+			for (const VkBufferCopy& other : regions) {
+				if (region.dstOffset < other.dstOffset + other.size && other.dstOffset < region.dstOffset + region.size) {
+					vkCmdCopyBuffer(cmd_buf.get_handle(), m_info.handle, dest, (uint32_t)regions.size(), regions.data());
+					vkCmdPipelineBarrier(cmd_buf.get_handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+					regions.clear();
+					break;
+				}
+			}
+			regions.push_back(region);
+		}
+
+		vkCmdCopyBuffer(cmd_buf.get_handle(), m_info.handle, dest, (uint32_t)regions.size(), regions.data());
+		regions.clear();
+	}
+}
+
+bool staging_buffer::submit(submission* sub) {
+	const context::queue_family_indices& families = context::get_queue_families();
+	bool same_family = families.graphics == families.transfer;
+	bool has_copies = !sub->copies.empty();
+	// the graphics queue acquires the copied buffers from another family and records the updates
+	bool has_graphics_work = (has_copies && !same_family) || !sub->updates.empty();
+
+	std::vector<VkBufferMemoryBarrier> barriers;
+	if (has_copies) {
+		if (!sub->cmd_buf.start(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT))
+			return false;
+		record_copies(sub->cmd_buf, sub->copies, &sub->destinations);
+
+		if (same_family) {
+			// the barrier makes the copies visible to everything submitted afterwards
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.pNext = NULL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			vkCmdPipelineBarrier(sub->cmd_buf.get_handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+		}else {
+			// the transfer queue releases the buffers and the graphics queue acquires them with identical barriers
+			barriers.resize(sub->destinations.size());
+			for (size_t i = 0; i < barriers.size(); i++) {
+				VkBufferMemoryBarrier& barrier = barriers[i];
+				barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				barrier.pNext = NULL;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = 0;
+				barrier.srcQueueFamilyIndex = (uint32_t)families.transfer;
+				barrier.dstQueueFamilyIndex = (uint32_t)families.graphics;
+				barrier.buffer = sub->destinations[i];
+				barrier.offset = 0;
+				barrier.size = VK_WHOLE_SIZE;
+			}
+			vkCmdPipelineBarrier(sub->cmd_buf.get_handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, (uint32_t)barriers.size(), barriers.data(), 0, NULL);
+		}
+		if (!sub->cmd_buf.end())
+			return false;
+	}
+
+	if (!has_graphics_work) {
+		sub->cmd_buf.submit(context::get_transfer_queue(), VK_NULL_HANDLE, VK_NULL_HANDLE, sub->fence, VK_PIPELINE_STAGE_TRANSFER_BIT);
+		return true;
+	}
+
+	if (!sub->graphics_cmd_buf.start(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT))
+		return false;
+	if (!barriers.empty()) {
+		for (VkBufferMemoryBarrier& barrier : barriers) {
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		}
+		// the source stages have to contain the stage the semaphore wait blocks, otherwise there is no dependency chain
+		vkCmdPipelineBarrier(sub->graphics_cmd_buf.get_handle(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, (uint32_t)barriers.size(), barriers.data(), 0, NULL);
+	}
+	if (!sub->updates.empty()) {
+		// frames that were submitted before may still read or write the buffers. The queue order puts them in front
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.pNext = NULL;
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(sub->graphics_cmd_buf.get_handle(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+		record_copies(sub->graphics_cmd_buf, sub->updates, NULL);
+
+		// compute shaders may write the buffers again, like the draw commands of an indirect buffer
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		vkCmdPipelineBarrier(sub->graphics_cmd_buf.get_handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	}
+	if (!sub->graphics_cmd_buf.end())
+		return false;
+
+	// the graphics submission comes before the frame on the graphics queue, so the frame does not have to know about the upload.
+	// It waits for the copies, so its fence covers the whole batch
+	VkSemaphore copies_finished = has_copies ? sub->copies_finished : VK_NULL_HANDLE;
+	if (has_copies)
+		sub->cmd_buf.submit(context::get_transfer_queue(), VK_NULL_HANDLE, copies_finished, VK_NULL_HANDLE, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	sub->graphics_cmd_buf.submit(context::get_graphics_queue(), copies_finished, VK_NULL_HANDLE, sub->fence, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+	return true;
+}
+
+// gives back the ring space of all finished submissions. If wait is set it blocks until the oldest one has finished
+void staging_buffer::reclaim(bool wait) {
+	VkDevice device = context::get_device();
+	allocator& allocator = context::get_memory_allocator();
+	while (!m_in_flight.empty()) {
+		submission* sub = m_in_flight.front();
+		VkResult status = wait ? vkWaitForFences(device, 1, &sub->fence, VK_TRUE, UINT64_MAX) : vkGetFenceStatus(device, sub->fence);
+		if (status != VK_SUCCESS)
+			break;
+		wait = false;
+
+		m_tail = sub->ring_end;
+		vkResetFences(device, 1, &sub->fence);
+		sub->cmd_buf.reset();
+		sub->graphics_cmd_buf.reset();
+		sub->copies.clear();
+		sub->updates.clear();
+		sub->destinations.clear();
+
+		// release replaced rings once their last copy has finished
+		for (size_t i = m_retired.size(); i-- > 0;) {
+			if (m_retired[i].last_submission_id <= sub->id) {
+				vkDestroyBuffer(device, m_retired[i].info.handle, NULL);
+				allocator.free(m_retired[i].info.memory);
+				m_retired.erase(m_retired.begin() + i);
+			}
+		}
+
+		m_unused.push_back(sub);
+		m_in_flight.pop_front();
+	}
+
+	// start at the beginning again so large chunks do not have to wrap
+	if (m_in_flight.empty() && m_current == NULL) {
+		m_head = 0;
+		m_tail = 0;
+	}
+}
+
+// m_head == m_tail always means that the ring is empty, so an allocation never closes the gap between head and tail completely
+bool staging_buffer::allocate(VkDeviceSize size, VkDeviceSize* offset) {
+	constexpr VkDeviceSize alignment = 16;
+	for (;;) {
+		reclaim(false);
+
+		VkDeviceSize head = align(m_head, alignment);
+		if (m_head >= m_tail) {
+			if (head + size <= m_size) {
+				*offset = head;
+				m_head = head + size;
+				return true;
+			}
+			// wrap around. The end of the ring stays unused until the tail passes it
+			if (size < m_tail) {
+				*offset = 0;
+				m_head = size;
+				return true;
+			}
+		}else if (head + size < m_tail) {
+			*offset = head;
+			m_head = head + size;
+			return true;
+		}
+
+		// not enough space. Growing is preferred over waiting for the gpu
+		if (m_size < m_max_size) {
+			if (!grow(size))
+				return false;
+			continue;
+		}
+
+		// submit what was recorded so far, so its space can be reclaimed
+		if (!flush())
+			return false;
+		if (m_in_flight.empty())
+			return false;
+		reclaim(true);
+	}
+}
+
+bool staging_buffer::grow(VkDeviceSize min_capacity) {
+	// copies that are recorded but not submitted still reference the current ring
+	if (!flush())
 		return false;
-	
 
+	size_t new_size = m_size * 2;
+	while (new_size < 2 * min_capacity)
+		new_size *= 2;
+	if (new_size > m_max_size)
+		new_size = m_max_size;
 
-	VkBufferCopy cpy {};
-	cpy.srcOffset = m_offset;
-	cpy.dstOffset = 0;
-	cpy.size = size;
-	m_offset = align(m_offset + size);
+	buffer_info new_info{};
+	if (!create_buffer(new_info, new_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true))
+		return false;
 
-	vkCmdCopyBuffer(cmd_buf.get_handle(), m_info.handle, dest, 1, &cpy);
+	if (m_in_flight.empty()) {
+		vkDestroyBuffer(context::get_device(), m_info.handle, NULL);
+		context::get_memory_allocator().free(m_info.memory);
+	}else {
+		retired_buffer& retired = m_retired.emplace_back();
+		retired.info = m_info;
+		retired.last_submission_id = m_in_flight.back()->id;
+	}
+
+	m_info = new_info;
+	m_size = new_size;
+	m_head = 0;
+	m_tail = 0;
+	// the submissions in flight refer to the old ring. Finishing them frees nothing in the new one
+	for (submission* sub : m_in_flight)
+		sub->ring_end = 0;
 	return true;
-}
\ No newline at end of file
+}
+
+
+std::shared_ptr<uniform_ring> uniform_ring::create(size_t capacity_per_frame, uint32_t binding_range) {
+	std::shared_ptr<uniform_ring> ring = std::make_shared<uniform_ring>();
+	if (!ring->initialize(capacity_per_frame, binding_range))
+		return NULL;
+	return ring;
+}
+
+bool uniform_ring::initialize(size_t capacity_per_frame, uint32_t binding_range) {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(context::get_physical_device(), &properties);
+	m_alignment = std::max(properties.limits.minUniformBufferOffsetAlignment, (VkDeviceSize)1);
+	m_binding_range = (uint32_t)std::min((VkDeviceSize)binding_range, (VkDeviceSize)properties.limits.maxUniformBufferRange);
+	m_frame_capacity = align(std::max(capacity_per_frame, (size_t)m_binding_range), m_alignment);
+
+	// the descriptor covers binding_range bytes behind every dynamic offset, so the last part needs room behind it
+	size_t capacity = m_frame_capacity * context::get_frames_in_flight() + m_binding_range;
+	if (!create_buffer(m_info, capacity, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, true))
+		return false;
+	m_frame_start = 0;
+	m_head = 0;
+	return true;
+}
+
+void uniform_ring::destroy() {
+	destroy_buffer(m_info);
+	m_frame_capacity = 0;
+	m_frame_start = 0;
+	m_head = 0;
+}
+
+void uniform_ring::begin_frame() {
+	// the fence of the frame that used this part last has signaled
+	m_frame_start = m_frame_capacity * context::current_frame_index();
+	m_head = 0;
+}
+
+void uniform_ring::end_frame() {
+	// one range for the whole frame. Does nothing on coherent memory
+	context::get_memory_allocator().flush(m_info.memory, m_frame_start, m_head);
+}
+
+bool uniform_ring::allocate(size_t size, allocation* alloc) {
+	assert(size <= m_binding_range && "uniform allocation is larger than the binding range");
+	size_t offset = align(m_head, m_alignment);
+	if (offset + size > m_frame_capacity)
+		return false;
+	m_head = offset + size;
+	alloc->data = (char*)m_info.memory.mapped + m_frame_start + offset;
+	alloc->dynamic_offset = (uint32_t)(m_frame_start + offset);
+	return true;
+}
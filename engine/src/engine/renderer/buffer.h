@@ -3,6 +3,9 @@
 
 #include <vulkan/vulkan.h>
 #include <memory>
+#include <deque>
+#include <vector>
+#include <string.h>
 #include "memory.h"
 #include "command_buffer.h"
 
@@ -18,23 +21,83 @@ struct buffer_info {
 };
 
 bool create_buffer(buffer_info& info, size_t capacity, VkBufferUsageFlags usage, bool host_visible = false);
-
+// the buffer and its memory are destroyed once the gpu has finished the work that is submitted or being recorded.
+// info is reset right away
+void destroy_buffer(buffer_info& info);
+
+/*
+* Persistent ring buffer for uploads.
+* Copies are collected until flush(). There they are sorted by destination and recorded with one vkCmdCopyBuffer
+* per destination into command buffers owned by the staging buffer, which are submitted to the transfer queue.
+* If the transfer queue belongs to another family, the destination buffers are released by the transfer queue
+* and acquired by a small submission on the graphics queue that waits for the copies with a semaphore.
+* Copies into buffers that frames in flight may still read are recorded into that graphics submission instead,
+* so the queue order places them behind those frames and no ownership has to go back to the transfer queue.
+* Every submission gets a fence. The ring space it used is reclaimed once that fence signals.
+* The ring grows up to a maximum capacity. Uploads that are larger than the ring are split into chunks.
+*/
 class staging_buffer {
 public:
-	static std::shared_ptr<staging_buffer> create();
+	static std::shared_ptr<staging_buffer> create(size_t capacity = 1 << 20);
 
 	void destroy();
 
+	// copies data to dest at the given offset. dest must have been created with VK_BUFFER_USAGE_TRANSFER_DST_BIT.
+	// Runs on the transfer queue, so dest must not be in use by the gpu, like a buffer that was just created
+	bool cpy(VkBuffer dest, VkDeviceAddress offset, const void* data, VkDeviceSize size);
+	// like cpy, but dest may still be read or written by submitted frames. Runs on the graphics queue after them
+	bool update(VkBuffer dest, VkDeviceAddress offset, const void* data, VkDeviceSize size);
 
-	bool cpy(command_buffer& cmd_buf, VkBuffer dest, VkDeviceAddress offset, const void* data, VkDeviceSize size);
-	void reset() { m_offset = 0; }
+	// submits all copies recorded since the last flush. Does not wait for the copies to finish
+	bool flush();
 
 	~staging_buffer() { destroy(); }
 private:
+	struct pending_copy {
+		VkBuffer dest;
+		VkBufferCopy region;
+	};
+
+	struct submission {
+		submission();
+
+		command_buffer cmd_buf; // copies and release barriers. Runs on the transfer queue
+		command_buffer graphics_cmd_buf; // acquire barriers and updates. Runs on the graphics queue
+		VkSemaphore copies_finished;
+		VkFence fence; // signaled by the last submission that belongs to this batch
+		std::vector<pending_copy> copies; // in the order cpy was called
+		std::vector<pending_copy> updates; // in the order update was called
+		std::vector<VkBuffer> destinations;
+		VkDeviceSize ring_end; // everything in front of this offset is free once the fence signals
+		uint64_t id;
+	};
+
+	// a smaller ring that was replaced while copies from it were in flight
+	struct retired_buffer {
+		buffer_info info;
+		uint64_t last_submission_id;
+	};
+
+	bool stage(VkBuffer dest, VkDeviceAddress offset, const void* data, VkDeviceSize size, bool graphics_queue);
+	bool allocate(VkDeviceSize size, VkDeviceSize* offset);
+	void reclaim(bool wait);
+	bool grow(VkDeviceSize min_capacity);
+	bool begin_submission();
+	void record_copies(command_buffer& cmd_buf, std::vector<pending_copy>& copies, std::vector<VkBuffer>* destinations);
+	bool submit(submission* sub);
 
 	buffer_info m_info{};
-	size_t m_size;
-	size_t m_offset = 0;
+	size_t m_size = 0;
+	size_t m_max_size = 1 << 26;
+
+	VkDeviceSize m_head = 0; // next free byte
+	VkDeviceSize m_tail = 0; // first byte still in use by the gpu
+
+	uint64_t m_next_submission_id = 0;
+	submission* m_current = NULL; // copies are recorded into this one. NULL if nothing was recorded since the last flush
+	std::deque<submission*> m_in_flight;
+	std::vector<submission*> m_unused;
+	std::vector<retired_buffer> m_retired;
 };
 
 
@@ -44,12 +107,14 @@ public:
 	~vertex_buffer() { destroy(); }
 	void destroy();
 
-	bool set_buffer_data(command_buffer& cmd_buf, std::shared_ptr<staging_buffer> staging, const void* data, size_t n_bytes);
+	bool set_buffer_data(std::shared_ptr<staging_buffer> staging, const void* data, size_t n_bytes);
+	// overwrites a part of the buffer. The range has to lie within the data set by set_buffer_data
+	bool update_buffer_data(std::shared_ptr<staging_buffer> staging, size_t offset, const void* data, size_t n_bytes);
 	const VkBuffer& get_handle() { return m_info.handle; }
 private:
 
 	buffer_info m_info{};
-	size_t m_size;
+	size_t m_size = 0;
 
 };
 
@@ -60,14 +125,125 @@ public:
 	~index_buffer() { destroy(); }
 	void destroy();
 
-	bool set_buffer_data(command_buffer& cmd_buf, std::shared_ptr<staging_buffer> staging, const uint32_t* indices, size_t n_bytes);
+	bool set_buffer_data(std::shared_ptr<staging_buffer> staging, const uint32_t* indices, size_t n_bytes);
+	// overwrites a part of the buffer. The range has to lie within the indices set by set_buffer_data
+	bool update_buffer_data(std::shared_ptr<staging_buffer> staging, size_t offset, const uint32_t* indices, size_t n_bytes);
 
 	const VkBuffer& get_handle() { return m_info.handle; }
 	const uint32_t index_count() const { return (uint32_t)m_size / sizeof(uint32_t); }
 private:
 	buffer_info m_info{};
-	size_t m_size;
+	size_t m_size = 0;
+
+};
+
+/*
+* Per instance vertex data like model matrices. Bound to a binding with VK_VERTEX_INPUT_RATE_INSTANCE,
+* so one instanced draw reads one element per instance.
+*/
+class instance_buffer {
+public:
+	static std::shared_ptr<instance_buffer> create();
+	~instance_buffer() { destroy(); }
+	void destroy();
+
+	// instance_size is the stride of the instance binding
+	bool set_buffer_data(std::shared_ptr<staging_buffer> staging, const void* instances, uint32_t instance_count, uint32_t instance_size);
+	// overwrites instances. The range has to lie within the instances set by set_buffer_data
+	bool update_buffer_data(std::shared_ptr<staging_buffer> staging, uint32_t first_instance, const void* instances, uint32_t instance_count);
 
+	const VkBuffer& get_handle() { return m_info.handle; }
+	uint32_t instance_count() const { return m_instance_count; }
+private:
+	buffer_info m_info{};
+	uint32_t m_instance_count = 0;
+	uint32_t m_instance_size = 0;
+};
+
+/*
+* Draw commands for vkCmdDrawIndexedIndirect in device memory.
+* The buffer starts with the draw count, the commands follow at COMMANDS_OFFSET.
+* The commands are written by the cpu through the staging buffer or by a compute shader,
+* which binds the buffer as a storage buffer. A whole scene is drawn with one call either way.
+*/
+class indirect_buffer {
+public:
+	static constexpr VkDeviceSize COUNT_OFFSET = 0;
+	static constexpr VkDeviceSize COMMANDS_OFFSET = 16;
+
+	static std::shared_ptr<indirect_buffer> create();
+	~indirect_buffer() { destroy(); }
+	void destroy();
+
+	// makes room for max_draws commands. Recorded commands are lost if the buffer has to grow
+	bool reserve(uint32_t max_draws);
+	// uploads the commands and the draw count
+	bool set_commands(std::shared_ptr<staging_buffer> staging, const VkDrawIndexedIndirectCommand* commands, uint32_t count);
+
+	// draws the count commands set by set_commands. Falls back to one call per command without multiDrawIndirect
+	void draw(command_buffer& cmd_buf) const;
+	// draws as many commands as the count in the buffer says, at most max_draws().
+	// Used when a compute shader wrote the commands. Needs the drawIndirectCount device feature
+	void draw_count(command_buffer& cmd_buf) const;
+
+	const VkBuffer& get_handle() { return m_info.handle; }
+	uint32_t max_draws() const { return m_max_draws; }
+	uint32_t command_count() const { return m_draw_count; }
+private:
+	buffer_info m_info{};
+	uint32_t m_max_draws = 0;
+	uint32_t m_draw_count = 0; // set by set_commands. The gpu may write a different count
+};
+
+/*
+* Uniform data that changes every frame, like per draw matrices or material blocks.
+* The buffer stays mapped and is split into one part per frame in flight. Allocations bump a head through the part
+* of the current frame, which is rewound once the fence of that frame has signaled.
+* The buffer is bound once as VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC with binding_range() and every
+* allocation is selected with its dynamic offset, so no descriptor set has to be written per draw.
+*/
+class uniform_ring {
+public:
+	// binding_range is the largest block one allocation may hold. It is limited by maxUniformBufferRange
+	static std::shared_ptr<uniform_ring> create(size_t capacity_per_frame = 1 << 20, uint32_t binding_range = 1 << 16);
+	~uniform_ring() { destroy(); }
+	void destroy();
+
+	// rewinds the part of the current frame. Called after context::begin_frame
+	void begin_frame();
+	// records the flush of the data written this frame. Called before the frame is submitted
+	void end_frame();
+
+	struct allocation {
+		void* data; // write the uniform data here
+		uint32_t dynamic_offset; // passed to vkCmdBindDescriptorSets
+	};
+	// size must not exceed binding_range(). Fails when the part of the frame is full
+	bool allocate(size_t size, allocation* alloc);
+	// copies the value into a new allocation and returns its dynamic offset
+	template<typename T>
+	bool push(const T& value, uint32_t* dynamic_offset) {
+		allocation alloc;
+		if (!allocate(sizeof(T), &alloc))
+			return false;
+		memcpy(alloc.data, &value, sizeof(T));
+		*dynamic_offset = alloc.dynamic_offset;
+		return true;
+	}
+
+	const VkBuffer& get_handle() { return m_info.handle; }
+	uint32_t binding_range() const { return m_binding_range; }
+	// bytes allocated by the current frame
+	size_t used() const { return m_head; }
+private:
+	bool initialize(size_t capacity_per_frame, uint32_t binding_range);
+
+	buffer_info m_info{};
+	VkDeviceSize m_alignment = 1;
+	size_t m_frame_capacity = 0;
+	uint32_t m_binding_range = 0;
+	size_t m_frame_start = 0; // offset of the part of the current frame
+	size_t m_head = 0; // next free byte, relative to m_frame_start
 };
 
 
@@ -0,0 +1,110 @@
+#include "command_allocator.h"
+#include "context.h"
+#include "engine/core/log.h"
+#include <future>
+
+bool command_allocator::initialize(uint32_t frames_in_flight, uint32_t worker_count) {
+	m_pools_per_frame = worker_count + 1;
+	m_pools.resize((size_t)frames_in_flight * m_pools_per_frame);
+	m_frame_index = 0;
+
+	VkCommandPoolCreateInfo create_info = { };
+	create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	create_info.pNext = NULL;
+	// command buffers are never reset one by one, only the whole pool
+	create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	create_info.queueFamilyIndex = context::get_queue_families().graphics;
+
+	for (pool& p : m_pools) {
+		if (vkCreateCommandPool(context::get_device(), &create_info, NULL, &p.handle) != VK_SUCCESS) {
+			err("Failed to create a frame command pool\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+void command_allocator::destroy() {
+	// destroying a pool frees its command buffers
+	for (pool& p : m_pools) {
+		if (p.handle != VK_NULL_HANDLE)
+			vkDestroyCommandPool(context::get_device(), p.handle, NULL);
+	}
+	m_pools.clear();
+}
+
+bool command_allocator::begin_frame(uint32_t frame_index) {
+	m_frame_index = frame_index;
+	bool success = true;
+	for (uint32_t i = 0; i < m_pools_per_frame; i++) {
+		pool& p = m_pools[(size_t)frame_index * m_pools_per_frame + i];
+		// pools that were not used since the last reset have nothing to reset
+		if (p.used[0] == 0 && p.used[1] == 0)
+			continue;
+		success &= vkResetCommandPool(context::get_device(), p.handle, 0) == VK_SUCCESS;
+		p.used[0] = 0;
+		p.used[1] = 0;
+	}
+	return success;
+}
+
+command_allocator::pool& command_allocator::current_pool() {
+	uint32_t thread = thread_pool::worker_index();
+	if (thread >= m_pools_per_frame - 1)
+		thread = m_pools_per_frame - 1;
+	return m_pools[(size_t)m_frame_index * m_pools_per_frame + thread];
+}
+
+command_buffer command_allocator::allocate(VkCommandBufferLevel level) {
+	pool& p = current_pool();
+	std::vector<VkCommandBuffer>& buffers = p.buffers[level];
+	uint32_t& used = p.used[level];
+
+	if (used == buffers.size()) {
+		VkCommandBufferAllocateInfo allocate_info = { };
+		allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocate_info.pNext = NULL;
+		allocate_info.commandBufferCount = 1;
+		allocate_info.commandPool = p.handle;
+		allocate_info.level = level;
+
+		VkCommandBuffer handle = VK_NULL_HANDLE;
+		if (vkAllocateCommandBuffers(context::get_device(), &allocate_info, &handle) != VK_SUCCESS)
+			return command_buffer(VK_NULL_HANDLE, p.handle);
+		buffers.push_back(handle);
+	}
+	return command_buffer(buffers[used++], p.handle);
+}
+
+bool command_allocator::record_parallel(thread_pool& workers, command_buffer& primary, const VkCommandBufferInheritanceInfo& inheritance, const std::vector<record_job>& jobs) {
+	std::vector<std::future<VkCommandBuffer>> recorded;
+	recorded.reserve(jobs.size());
+	for (const record_job& job : jobs) {
+		recorded.push_back(workers.submit([this, &job, &inheritance]() -> VkCommandBuffer {
+			command_buffer cmd_buf = allocate(VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+			if (cmd_buf.get_handle() == VK_NULL_HANDLE || !cmd_buf.start(inheritance, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT))
+				return VK_NULL_HANDLE;
+			job(cmd_buf);
+			return cmd_buf.end() ? cmd_buf.get_handle() : VK_NULL_HANDLE;
+		}));
+	}
+
+	// all futures are waited for, so the jobs are done before they go out of scope
+	bool success = true;
+	std::vector<VkCommandBuffer> secondaries;
+	secondaries.reserve(jobs.size());
+	for (std::future<VkCommandBuffer>& result : recorded) {
+		VkCommandBuffer handle = result.get();
+		if (handle == VK_NULL_HANDLE)
+			success = false;
+		else
+			secondaries.push_back(handle);
+	}
+	if (!success) {
+		err("Failed to record secondary command buffers\n");
+		return false;
+	}
+	if (!secondaries.empty())
+		vkCmdExecuteCommands(primary.get_handle(), (uint32_t)secondaries.size(), secondaries.data());
+	return true;
+}
@@ -0,0 +1,50 @@
+#ifndef ENGINE_RENDERER_COMMAND_ALLOCATOR_H
+#define ENGINE_RENDERER_COMMAND_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <functional>
+#include "command_buffer.h"
+#include "engine/core/thread_pool.h"
+
+/*
+* Hands out graphics command buffers that live for a single frame in flight.
+* Command pools must only be used by one thread at a time, so every frame has one pool per worker of the
+* thread pool and one for all other threads. All pools of a frame are reset together when the frame starts again
+* and their command buffers are handed out again instead of being freed.
+*/
+class command_allocator {
+public:
+	using record_job = std::function<void(command_buffer& cmd_buf)>;
+
+	bool initialize(uint32_t frames_in_flight, uint32_t worker_count);
+	void destroy();
+
+	// resets all pools of the frame. The fence of the frame has to be signaled
+	bool begin_frame(uint32_t frame_index);
+
+	// takes a command buffer from the pool of the calling thread. It is valid until the frame starts again
+	// and must not be destroyed
+	command_buffer allocate(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+	// records every job into its own secondary command buffer on the workers and executes them from the primary in job order.
+	// The primary has to be inside the render pass of the inheritance info, begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+	// No state is inherited, so every job binds its own pipeline, buffers, viewport and scissor
+	bool record_parallel(thread_pool& workers, command_buffer& primary, const VkCommandBufferInheritanceInfo& inheritance, const std::vector<record_job>& jobs);
+
+private:
+	struct pool {
+		VkCommandPool handle = VK_NULL_HANDLE;
+		// indexed by VkCommandBufferLevel
+		std::vector<VkCommandBuffer> buffers[2];
+		uint32_t used[2] = {};
+	};
+	pool& current_pool();
+
+	// frame_index * m_pools_per_frame + thread. The last pool of a frame is for threads that are not workers
+	std::vector<pool> m_pools;
+	uint32_t m_pools_per_frame = 0;
+	uint32_t m_frame_index = 0;
+};
+
+#endif //ENGINE_RENDERER_COMMAND_ALLOCATOR_H
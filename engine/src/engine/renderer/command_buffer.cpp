@@ -1,32 +1,99 @@
 #include "command_buffer.h"
 #include "context.h"
+#include <assert.h>
 
 
-command_buffer::command_buffer(VkCommandBufferLevel level) : m_handle(VK_NULL_HANDLE) {
+command_buffer::command_buffer(VkCommandBufferLevel level) : command_buffer(context::get_command_pool(), level) { }
+
+command_buffer::command_buffer(VkCommandPool pool, VkCommandBufferLevel level) : m_handle(VK_NULL_HANDLE), m_pool(pool) {
 	VkCommandBufferAllocateInfo allocate_info = { };
 	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocate_info.pNext = NULL;
 	allocate_info.commandBufferCount = 1;
-	allocate_info.commandPool = context::get_command_pool();
+	allocate_info.commandPool = pool;
 	allocate_info.level = level;
 
 	vkAllocateCommandBuffers(context::get_device(), &allocate_info, &m_handle);
 }
 
-bool command_buffer::start() {
+bool command_buffer::start(VkCommandBufferUsageFlags flags) {
 	VkCommandBufferBeginInfo info = { };
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	info.pNext = NULL;
-	info.flags = 0;
+	info.flags = flags;
 	info.pInheritanceInfo = NULL;
 	return vkBeginCommandBuffer(m_handle, &info) == VK_SUCCESS;
 }
+
+static bool inherits_rendering(const VkCommandBufferInheritanceInfo& inheritance) {
+	for (const VkBaseInStructure* next = (const VkBaseInStructure*)inheritance.pNext; next != NULL; next = next->pNext) {
+		if (next->sType == VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO)
+			return true;
+	}
+	return false;
+}
+
+bool command_buffer::start(const VkCommandBufferInheritanceInfo& inheritance, VkCommandBufferUsageFlags flags) {
+	VkCommandBufferBeginInfo info = { };
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	info.pNext = NULL;
+	info.flags = flags;
+	if (inheritance.renderPass != VK_NULL_HANDLE || inherits_rendering(inheritance))
+		info.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	info.pInheritanceInfo = &inheritance;
+	return vkBeginCommandBuffer(m_handle, &info) == VK_SUCCESS;
+}
+
+static void init_attachment_info(VkRenderingAttachmentInfo& info, const command_buffer::rendering_attachment& attachment) {
+	info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	info.pNext = NULL;
+	info.imageView = attachment.view;
+	info.imageLayout = attachment.layout;
+	info.resolveMode = VK_RESOLVE_MODE_NONE;
+	info.resolveImageView = VK_NULL_HANDLE;
+	info.resolveImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.loadOp = attachment.load_op;
+	info.storeOp = attachment.store_op;
+	info.clearValue = attachment.clear_value;
+}
+
+void command_buffer::begin_rendering(VkExtent2D extent, const rendering_attachment* color_attachments, uint32_t color_count,
+		const rendering_attachment* depth_attachment, const rendering_attachment* stencil_attachment, bool secondary_contents) {
+	assert(color_count <= MAX_COLOR_ATTACHMENTS);
+	VkRenderingAttachmentInfo colors[MAX_COLOR_ATTACHMENTS];
+	for (uint32_t i = 0; i < color_count; i++)
+		init_attachment_info(colors[i], color_attachments[i]);
+	VkRenderingAttachmentInfo depth, stencil;
+	if (depth_attachment)
+		init_attachment_info(depth, *depth_attachment);
+	if (stencil_attachment)
+		init_attachment_info(stencil, *stencil_attachment);
+
+	VkRenderingInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	info.pNext = NULL;
+	info.flags = secondary_contents ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+	info.renderArea.offset = { 0, 0 };
+	info.renderArea.extent = extent;
+	info.layerCount = 1;
+	info.viewMask = 0;
+	info.colorAttachmentCount = color_count;
+	info.pColorAttachments = color_count > 0 ? colors : NULL;
+	info.pDepthAttachment = depth_attachment ? &depth : NULL;
+	info.pStencilAttachment = stencil_attachment ? &stencil : NULL;
+	vkCmdBeginRendering(m_handle, &info);
+}
+
+void command_buffer::end_rendering() {
+	vkCmdEndRendering(m_handle);
+}
+
 bool command_buffer::end() {
 	return vkEndCommandBuffer(m_handle) == VK_SUCCESS;
 }
 
 void command_buffer::destroy() {
-	vkFreeCommandBuffers(context::get_device(), context::get_command_pool(), 1, &m_handle);
+	vkFreeCommandBuffers(context::get_device(), m_pool, 1, &m_handle);
 }
 
 VkResult command_buffer::reset() {
@@ -34,17 +101,18 @@ VkResult command_buffer::reset() {
 }
 
 void command_buffer::submit(VkQueue queue, VkSemaphore wait_semaphore, VkSemaphore signal, VkFence fence, VkPipelineStageFlags wait_stage) {
-	VkPipelineStageFlags wait_stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
 	VkSubmitInfo submit_info = {};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submit_info.pNext = NULL;
 	submit_info.waitSemaphoreCount = wait_semaphore != VK_NULL_HANDLE;
 	submit_info.pWaitSemaphores = &wait_semaphore;
-	submit_info.pWaitDstStageMask = &wait_stages;
+	submit_info.pWaitDstStageMask = &wait_stage;
 	submit_info.commandBufferCount = 1;
 	submit_info.pCommandBuffers = &m_handle;
 	submit_info.signalSemaphoreCount = signal != VK_NULL_HANDLE;
 	submit_info.pSignalSemaphores = &signal;
 
+	// host writes to mapped memory have to be visible before the device reads them
+	context::get_memory_allocator().flush_mapped_ranges();
 	vkQueueSubmit(queue, 1, &submit_info, fence);
 }
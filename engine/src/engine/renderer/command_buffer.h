@@ -7,10 +7,32 @@ class command_buffer {
 public:
 
 	command_buffer(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+	// the command buffer can only be submitted to queues of the family the pool was created for
+	command_buffer(VkCommandPool pool, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+	// wraps a command buffer that is owned by someone else, like the command_allocator
+	command_buffer(VkCommandBuffer handle, VkCommandPool pool) : m_handle(handle), m_pool(pool) {}
 	
-	bool start();
+	bool start(VkCommandBufferUsageFlags flags = 0);
+	// for secondary command buffers. They continue the render pass of the inheritance info if it has one,
+	// or the dynamic rendering if a VkCommandBufferInheritanceRenderingInfo is chained to it
+	bool start(const VkCommandBufferInheritanceInfo& inheritance, VkCommandBufferUsageFlags flags = 0);
 	bool end();
 
+	static constexpr uint32_t MAX_COLOR_ATTACHMENTS = 8;
+	struct rendering_attachment {
+		VkImageView view;
+		VkImageLayout layout; // the image has to be in this layout already
+		VkAttachmentLoadOp load_op;
+		VkAttachmentStoreOp store_op;
+		VkClearValue clear_value;
+	};
+	// dynamic rendering directly into image views, without render pass and framebuffer objects.
+	// depth and stencil may be NULL. They usually are the same view of a depth stencil image.
+	// With secondary_contents the draws come from secondary command buffers that inherit the rendering
+	void begin_rendering(VkExtent2D extent, const rendering_attachment* color_attachments, uint32_t color_count,
+		const rendering_attachment* depth_attachment = NULL, const rendering_attachment* stencil_attachment = NULL, bool secondary_contents = false);
+	void end_rendering();
+
 	VkResult reset();
 	void destroy();
 
@@ -24,9 +46,11 @@ public:
 	void submit(VkQueue queue, VkSemaphore wait_semaphore, VkSemaphore signal, VkPipelineStageFlags wait_stage) {
 		submit(queue, wait_semaphore, signal, VK_NULL_HANDLE, wait_stage);
 	}
+	// submits only this command buffer. Use a submit_batch to hand several submissions to the queue at once
 	void submit(VkQueue queue, VkSemaphore wait_semaphore, VkSemaphore signal, VkFence fence, VkPipelineStageFlags wait_stage);
 private:
 	VkCommandBuffer m_handle;
+	VkCommandPool m_pool;
 };
 
 #endif //ENGINE_RENDERER_COMMAND_BUFFER_H
\ No newline at end of file
@@ -1,54 +1,89 @@
 #include "context.h"
 #include "render_api.h"
 #include <vector>
+#include <string.h>
+#include <stdio.h>
 #include "synchronization.h"
+#include "engine/core/log.h"
 
 
 context* context::s_current = NULL;
 
 
-context* context::create_context(window_handle_t handle) {
+context* context::create_context(window_handle_t handle, uint32_t frames_in_flight) {
 	context* ctx = new context;
-	if (!ctx->init(handle)) {
+	if (!ctx->init(handle, frames_in_flight)) {
 		delete ctx;
 		return NULL;
 	}
 	return ctx;
 }
 
-bool context::init(window_handle_t handle) {
+bool context::init(window_handle_t handle, uint32_t frames_in_flight) {
+	// images and deferred destructions during init go through the static accessors
+	make_context_current();
+
 	if (!create_surface(handle))
 		return false;
 
-	std::vector<const char*> required_extensions = { "VK_KHR_swapchain" };
+	// without a surface nothing is presented
+	std::vector<const char*> required_extensions;
+	if (m_surface.surface != VK_NULL_HANDLE)
+		required_extensions.push_back("VK_KHR_swapchain");
 	if (!select_physical_device(required_extensions))
 		return false;
 	if (!create_logical_device(required_extensions))
 		return false;
-	if (!create_swapchain())
+
+	if (!m_graphics_timeline.create(m_device))
 		return false;
-	if (!create_command_pool())
+	m_allocator.initialize(m_physical_device, m_device);
+	m_descriptor_layout_cache.initialize(m_device);
+	m_descriptor_allocator.initialize(m_device);
+	if (!m_pipeline_cache.initialize(m_physical_device, m_device, "pipeline_cache.bin"))
 		return false;
 
-	m_allocator.initialize(m_physical_device, m_device);
+	if (!create_command_pool())
+		return false;
+	if (!create_frame_data(frames_in_flight))
+		return false;
+	if (!create_swapchain())
+		return false;
+	if (!create_swapchain_image_views())
+		return false;
+	m_images_in_flight.assign(m_swapchain.image_count, VK_NULL_HANDLE);
 
+	return true;
+}
 
+bool context::create_frame_data(uint32_t frames_in_flight) {
+	// the fences start signaled so the first wait of every frame returns immediately
 	VkFenceCreateInfo create_info = { };
 	create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	create_info.pNext = NULL;
-	create_info.flags = 0;
-
-	if (vkCreateFence(m_device, &create_info, NULL, &m_in_flight_fence) != VK_SUCCESS)
-		return false;
+	create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
 	VkSemaphoreCreateInfo semaphore_create_info{};
 	semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 	semaphore_create_info.pNext = NULL;
 	semaphore_create_info.flags = 0;
 
-	if (vkCreateSemaphore(m_device, &semaphore_create_info, NULL, &m_acquired_semaphore) != VK_SUCCESS)
-		return false;
+	if (frames_in_flight == 0)
+		frames_in_flight = 1;
+	m_frames.resize(frames_in_flight);
+	for (frame_data& frame : m_frames) {
+		if (vkCreateFence(m_device, &create_info, NULL, &frame.in_flight_fence) != VK_SUCCESS)
+			return false;
+		frame.descriptors.initialize(m_device);
 
+		// nothing would signal or wait on the semaphores without a swapchain. They stay VK_NULL_HANDLE
+		if (m_surface.surface == VK_NULL_HANDLE)
+			continue;
+		if (vkCreateSemaphore(m_device, &semaphore_create_info, NULL, &frame.acquired_semaphore) != VK_SUCCESS)
+			return false;
+		if (vkCreateSemaphore(m_device, &semaphore_create_info, NULL, &frame.render_finished_semaphore) != VK_SUCCESS)
+			return false;
+	}
 	return true;
 }
 
@@ -96,6 +131,12 @@ bool context::select_physical_device(const std::vector<const char*>& extensions)
 			continue;
 		VkPhysicalDeviceProperties properties;
 		vkGetPhysicalDeviceProperties(devices[i], &properties);
+		// dynamic rendering, timeline semaphores and pipeline creation feedback are used without checking
+		if (properties.apiVersion < VK_API_VERSION_1_3) {
+			log("Skipping %s: it supports Vulkan %u.%u, but 1.3 is required\n", properties.deviceName,
+				VK_API_VERSION_MAJOR(properties.apiVersion), VK_API_VERSION_MINOR(properties.apiVersion));
+			continue;
+		}
 		uint32_t family_count;
 		vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &family_count, NULL);
 		VkQueueFamilyProperties* queue_families = new VkQueueFamilyProperties[family_count];
@@ -107,8 +148,9 @@ bool context::select_physical_device(const std::vector<const char*>& extensions)
 		for (uint32_t f = 0; f < family_count; f++) {
 			VkQueueFlags flags = queue_families[f].queueFlags;
 			if (flags & VK_QUEUE_GRAPHICS_BIT) {
-				VkBool32 supports_surface;
-				vkGetPhysicalDeviceSurfaceSupportKHR(devices[i], f, m_surface.surface, &supports_surface);
+				VkBool32 supports_surface = VK_TRUE;
+				if (m_surface.surface != VK_NULL_HANDLE)
+					vkGetPhysicalDeviceSurfaceSupportKHR(devices[i], f, m_surface.surface, &supports_surface);
 				if (supports_surface)
 					current.graphics = f;
 			}
@@ -136,6 +178,8 @@ bool context::select_physical_device(const std::vector<const char*>& extensions)
 
 	m_physical_device = pick;
 	delete[] devices;
+	if (m_physical_device == VK_NULL_HANDLE)
+		err("No device supports Vulkan 1.3 with the required extensions and queues\n");
 	return m_physical_device != VK_NULL_HANDLE;
 }
 
@@ -172,6 +216,45 @@ bool context::create_logical_device(const std::vector<const char*>& extensions)
 	create_info.ppEnabledExtensionNames = extensions.size() > 0 ? &extensions[0] : NULL;
 	create_info.pEnabledFeatures = NULL;
 	create_info.pQueueCreateInfos = queueCreateInfos;
+
+	VkPhysicalDeviceVulkan12Features supported_vulkan12_features = {};
+	supported_vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	supported_vulkan12_features.pNext = NULL;
+	VkPhysicalDeviceVulkan11Features supported_vulkan11_features = {};
+	supported_vulkan11_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+	supported_vulkan11_features.pNext = &supported_vulkan12_features;
+	VkPhysicalDeviceFeatures2 supported_features = {};
+	supported_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supported_features.pNext = &supported_vulkan11_features;
+	vkGetPhysicalDeviceFeatures2(m_physical_device, &supported_features);
+
+	// dynamic rendering is core since 1.3 and always supported
+	VkPhysicalDeviceVulkan13Features vulkan13_features = {};
+	vulkan13_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+	vulkan13_features.pNext = NULL;
+	vulkan13_features.dynamicRendering = VK_TRUE;
+	// timeline semaphores are core since 1.2 and always supported
+	VkPhysicalDeviceVulkan12Features vulkan12_features = {};
+	vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12_features.pNext = &vulkan13_features;
+	vulkan12_features.timelineSemaphore = VK_TRUE;
+	// optional features. Users check get_device_features
+	vulkan12_features.drawIndirectCount = supported_vulkan12_features.drawIndirectCount;
+	VkPhysicalDeviceVulkan11Features vulkan11_features = {};
+	vulkan11_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+	vulkan11_features.pNext = &vulkan12_features;
+	vulkan11_features.shaderDrawParameters = supported_vulkan11_features.shaderDrawParameters;
+	VkPhysicalDeviceFeatures2 enabled_features = {};
+	enabled_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	enabled_features.pNext = &vulkan11_features;
+	enabled_features.features.multiDrawIndirect = supported_features.features.multiDrawIndirect;
+	enabled_features.features.drawIndirectFirstInstance = supported_features.features.drawIndirectFirstInstance;
+	create_info.pNext = &enabled_features;
+
+	m_device_features.multi_draw_indirect = enabled_features.features.multiDrawIndirect == VK_TRUE;
+	m_device_features.draw_indirect_count = vulkan12_features.drawIndirectCount == VK_TRUE;
+	m_device_features.draw_indirect_first_instance = enabled_features.features.drawIndirectFirstInstance == VK_TRUE;
+	m_device_features.shader_draw_parameters = vulkan11_features.shaderDrawParameters == VK_TRUE;
 	create_info.queueCreateInfoCount = queue_create_info_count;
 
 
@@ -232,6 +315,9 @@ static VkPresentModeKHR select_present_mode(VkPhysicalDevice device, VkSurfaceKH
 }
 
 bool context::create_swapchain() {
+	if (m_surface.surface == VK_NULL_HANDLE)
+		return create_offscreen_images();
+
 	VkSurfaceCapabilitiesKHR capabilities;
 	if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(m_physical_device, m_surface.surface, &capabilities) != VK_SUCCESS)
 		return VK_NULL_HANDLE;
@@ -286,6 +372,52 @@ bool context::create_swapchain() {
 }
 
 
+// one offscreen image per frame in flight, so a frame never waits for an image the previous frame still renders to
+bool context::create_offscreen_images() {
+	destroy_offscreen_images();
+
+	m_swapchain.swapchain = VK_NULL_HANDLE;
+	m_swapchain.extent = m_offscreen_extent;
+	m_swapchain.image_count = (uint32_t)m_frames.size();
+	m_swapchain.images = new VkImage[m_swapchain.image_count];
+
+	m_offscreen_images.resize(m_swapchain.image_count);
+	for (uint32_t i = 0; i < m_swapchain.image_count; i++) {
+		if (!create_image(m_offscreen_images[i], m_offscreen_extent.width, m_offscreen_extent.height, m_surface.surface_format.format,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+			return false;
+		m_swapchain.images[i] = m_offscreen_images[i].handle;
+	}
+	return true;
+}
+
+void context::destroy_offscreen_images() {
+	for (image_info& image : m_offscreen_images)
+		destroy_image(image);
+	m_offscreen_images.clear();
+	delete[] m_swapchain.images;
+	m_swapchain.images = NULL;
+	m_swapchain.image_count = 0;
+}
+
+// views for dynamic rendering. The old views may still be used by frames in flight
+bool context::create_swapchain_image_views() {
+	std::vector<VkImageView> old = std::move(m_swapchain_image_views);
+	if (!old.empty()) {
+		VkDevice device = m_device;
+		defer_destruction_impl([device, old]() {
+			for (VkImageView view : old)
+				vkDestroyImageView(device, view, NULL);
+		});
+	}
+	m_swapchain_image_views.assign(m_swapchain.image_count, VK_NULL_HANDLE);
+	for (uint32_t i = 0; i < m_swapchain.image_count; i++) {
+		if (!create_image_view(m_swapchain.images[i], m_surface.surface_format.format, &m_swapchain_image_views[i]))
+			return false;
+	}
+	return true;
+}
+
 bool context::create_command_pool() {
 
 	VkCommandPoolCreateInfo create_info = { };
@@ -294,7 +426,12 @@ bool context::create_command_pool() {
 	create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 	create_info.queueFamilyIndex = m_queue_family_indices.graphics;
 
-	return vkCreateCommandPool(m_device, &create_info, NULL, &m_command_pool) == VK_SUCCESS;
+	if (vkCreateCommandPool(m_device, &create_info, NULL, &m_command_pool) != VK_SUCCESS)
+		return false;
+
+	// uploads are recorded on the transfer queue
+	create_info.queueFamilyIndex = m_queue_family_indices.transfer;
+	return vkCreateCommandPool(m_device, &create_info, NULL, &m_transfer_command_pool) == VK_SUCCESS;
 }
 
 void context::make_context_current() {
@@ -305,13 +442,30 @@ context::~context() {
 	
 
 	delete[] m_window_framebuffers;
+	for (VkImageView view : m_swapchain_image_views)
+		vkDestroyImageView(m_device, view, NULL);
+
+	for (frame_data& frame : m_frames) {
+		if (frame.acquired_semaphore != VK_NULL_HANDLE)
+			vkDestroySemaphore(m_device, frame.acquired_semaphore, NULL);
+		if (frame.render_finished_semaphore != VK_NULL_HANDLE)
+			vkDestroySemaphore(m_device, frame.render_finished_semaphore, NULL);
+		if (frame.in_flight_fence != VK_NULL_HANDLE)
+			vkDestroyFence(m_device, frame.in_flight_fence, NULL);
+		frame.descriptors.destroy();
+	}
 
-	if(m_acquired_semaphore != VK_NULL_HANDLE)
-		vkDestroySemaphore(m_device, m_acquired_semaphore, NULL);
-	if (m_in_flight_fence != VK_NULL_HANDLE)
-		vkDestroyFence(m_device, m_in_flight_fence, NULL);
-
+	if (m_surface.surface == VK_NULL_HANDLE)
+		destroy_offscreen_images();
+	destroy_depth_image();
+	// the device is idle, so everything that waits for the gpu can go
+	m_deletion_queue.flush();
+	m_graphics_timeline.destroy();
+	m_descriptor_allocator.destroy();
+	m_descriptor_layout_cache.destroy();
 	m_allocator.destroy();
+	m_pipeline_registry.destroy(m_device);
+	m_pipeline_cache.destroy();
 
 	if (m_swapchain.swapchain) {
 		vkDestroySwapchainKHR(m_device, m_swapchain.swapchain, NULL);
@@ -319,6 +473,8 @@ context::~context() {
 	}
 	if (m_command_pool != VK_NULL_HANDLE)
 		vkDestroyCommandPool(m_device, m_command_pool, NULL);
+	if (m_transfer_command_pool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(m_device, m_transfer_command_pool, NULL);
 
 	if (m_surface.surface)
 		vkDestroySurfaceKHR(render_api::get_instance(), m_surface.surface, NULL);
@@ -332,12 +488,32 @@ context::~context() {
 }
 
 
-bool context::create_window_framebuffers_impl(VkRenderPass render_pass) {
-	delete[] m_window_framebuffers;
+void context::defer_destruction_impl(deletion_queue::destroy_function destroy) {
+	m_deletion_queue.push(m_graphics_timeline.pending_value(), std::move(destroy));
+}
+
+bool context::create_window_framebuffers_impl(VkRenderPass render_pass, VkFormat depth_format) {
+	// frames in flight may still render into the old framebuffers
+	framebuffer* old = m_window_framebuffers;
+	if (old != NULL)
+		defer_destruction_impl([old]() { delete[] old; });
+	m_window_framebuffers = NULL;
+	// clients that use dynamic rendering render into the swapchain image views and need no framebuffers.
+	// Only render passes move the depth image of the context out of its undefined layout, so they bring their own
+	if (render_pass == VK_NULL_HANDLE) {
+		destroy_depth_image();
+		if (m_framebuffer_change_callback)
+			m_framebuffer_change_callback();
+		return true;
+	}
+	if (!create_depth_image(depth_format))
+		return false;
 	m_window_framebuffers = new framebuffer[m_swapchain.image_count];
 
 	for (uint32_t img_index = 0; img_index < m_swapchain.image_count; img_index++) {
 		m_window_framebuffers[img_index].add_color_attachment(m_swapchain.images[img_index], m_surface.surface_format.format);
+		if (m_depth_image.handle != VK_NULL_HANDLE)
+			m_window_framebuffers[img_index].add_depth_stencil_attachment(m_depth_image.handle, m_depth_image.format);
 		m_window_framebuffers[img_index].create(render_pass, m_swapchain.extent.width, m_swapchain.extent.height);
 	}
 
@@ -347,16 +523,49 @@ bool context::create_window_framebuffers_impl(VkRenderPass render_pass) {
 	return true;
 }
 
-bool context::recreate_swapchain_impl(VkRenderPass render_pass) {
-	vkDeviceWaitIdle(m_device);
+// the depth image is only recreated if the extent or the format changed. Frames in flight share it: render passes
+// order the depth writes of consecutive frames with their external dependency
+bool context::create_depth_image(VkFormat format) {
+	if (m_depth_image.handle != VK_NULL_HANDLE && m_depth_image.format == format
+		&& m_depth_image.extent.width == m_swapchain.extent.width && m_depth_image.extent.height == m_swapchain.extent.height)
+		return true;
+	destroy_depth_image();
+	if (format == VK_FORMAT_UNDEFINED)
+		return true;
+	if (!create_image(m_depth_image, m_swapchain.extent.width, m_swapchain.extent.height, format, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT))
+		return false;
+	return create_image_view(m_depth_image.handle, format, &m_depth_image_view);
+}
+
+void context::destroy_depth_image() {
+	if (m_depth_image_view != VK_NULL_HANDLE) {
+		VkDevice device = m_device;
+		VkImageView view = m_depth_image_view;
+		defer_destruction_impl([device, view]() { vkDestroyImageView(device, view, NULL); });
+		m_depth_image_view = VK_NULL_HANDLE;
+	}
+	destroy_image(m_depth_image);
+}
+
+bool context::recreate_swapchain_impl(VkRenderPass render_pass, VkFormat depth_format) {
+	// nothing waits for the device here. The old swapchain and framebuffers are destroyed once the frames that use them are done
+	if (m_surface.surface == VK_NULL_HANDLE) {
+		// the offscreen images never go out of date
+		return create_window_framebuffers(render_pass, depth_format);
+	}
 	VkSwapchainKHR old = m_swapchain.swapchain;
 	if (!create_swapchain())
 		return false;
-	if (old != VK_NULL_HANDLE)
-		vkDestroySwapchainKHR(m_device, old, NULL);
+	if (!create_swapchain_image_views())
+		return false;
+	if (old != VK_NULL_HANDLE) {
+		VkDevice device = m_device;
+		defer_destruction_impl([device, old]() { vkDestroySwapchainKHR(device, old, NULL); });
+	}
+	m_images_in_flight.assign(m_swapchain.image_count, VK_NULL_HANDLE);
 
 
-	if (!create_window_framebuffers(render_pass))
+	if (!create_window_framebuffers(render_pass, depth_format))
 		return false;
 
 	return true;
@@ -364,16 +573,34 @@ bool context::recreate_swapchain_impl(VkRenderPass render_pass) {
 
 
 VkResult context::begin_frame_impl(uint32_t* image_index) {
+	frame_data& frame = m_frames[m_frame_index];
 
+	// only wait for the gpu to finish the frame that used these resources the last time
 	constexpr uint64_t wait_timeout = (uint64_t)1e9;
-	vkWaitForFences(m_device, 1, &m_in_flight_fence, VK_TRUE, wait_timeout);
-	VkResult res = vkAcquireNextImageKHR(m_device, m_swapchain.swapchain, wait_timeout,
-		m_acquired_semaphore, VK_NULL_HANDLE, &m_current_image_index);
-	vkResetFences(m_device, 1, &m_in_flight_fence);
-
-	if (res == VK_TIMEOUT)
+	VkResult res = vkWaitForFences(m_device, 1, &frame.in_flight_fence, VK_TRUE, wait_timeout);
+	if (res != VK_SUCCESS)
 		return res;
 
+	if (m_surface.surface != VK_NULL_HANDLE) {
+		res = vkAcquireNextImageKHR(m_device, m_swapchain.swapchain, wait_timeout,
+			frame.acquired_semaphore, VK_NULL_HANDLE, &m_current_image_index);
+		if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
+			return res;
+	}else {
+		m_current_image_index = m_frame_index % m_swapchain.image_count;
+	}
+
+	// the image may still be rendered to by an older frame
+	VkFence& image_fence = m_images_in_flight[m_current_image_index];
+	if (image_fence != VK_NULL_HANDLE && image_fence != frame.in_flight_fence)
+		vkWaitForFences(m_device, 1, &image_fence, VK_TRUE, UINT64_MAX);
+	image_fence = frame.in_flight_fence;
+
+	vkResetFences(m_device, 1, &frame.in_flight_fence);
+
+	// the frame fence has signaled, so the timeline has at least reached the value of that frame
+	m_deletion_queue.collect(m_graphics_timeline.completed_value());
+	frame.descriptors.reset();
 
 	if (image_index)
 		*image_index = m_current_image_index;
@@ -381,6 +608,11 @@ VkResult context::begin_frame_impl(uint32_t* image_index) {
 }
 
 VkResult context::end_frame_impl(VkSemaphore wait_semaphore) {
+	if (m_surface.surface == VK_NULL_HANDLE) {
+		m_frame_index = (m_frame_index + 1) % (uint32_t)m_frames.size();
+		return VK_SUCCESS;
+	}
+
 	VkPresentInfoKHR present_info = {};
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	present_info.pNext = NULL;
@@ -391,5 +623,7 @@ VkResult context::end_frame_impl(VkSemaphore wait_semaphore) {
 	present_info.pImageIndices = &m_current_image_index;
 	present_info.pResults = NULL;
 
-	return vkQueuePresentKHR(context::get_graphics_queue(), &present_info);
+	VkResult res = vkQueuePresentKHR(context::get_graphics_queue(), &present_info);
+	m_frame_index = (m_frame_index + 1) % (uint32_t)m_frames.size();
+	return res;
 }
@@ -5,13 +5,21 @@
 #include <vulkan/vulkan.h>
 #include "framebuffer.h"
 #include "memory.h"
+#include "image.h"
+#include "pipeline_cache.h"
+#include "pipeline.h"
+#include "gpu_timeline.h"
+#include "deletion_queue.h"
+#include "descriptor.h"
 #include <functional>
+#include <vector>
 
 
 class context {
 public:
 	using framebuffer_change_callback = std::function<void()>;
-	static context* create_context(window_handle_t handle);
+	// frames_in_flight is the number of frames the cpu may record ahead of the gpu
+	static context* create_context(window_handle_t handle, uint32_t frames_in_flight = 2);
 	void make_context_current();
 
 	~context();
@@ -33,6 +41,13 @@ public:
 		int transfer;
 		bool dedicated_transfer = false;
 	};
+	// optional features. They are enabled if the device supports them
+	struct device_features {
+		bool multi_draw_indirect = false; // more than one draw per indirect draw call
+		bool draw_indirect_count = false; // vkCmdDrawIndexedIndirectCount
+		bool draw_indirect_first_instance = false; // indirect draw commands with a first instance other than 0
+		bool shader_draw_parameters = false; // gl_DrawID and gl_BaseInstance in shaders
+	};
 
 
 	const VkDevice& device() const { return m_device; }
@@ -46,49 +61,94 @@ public:
 	static const surface& get_surface() { return s_current->m_surface; }
 	static const swapchain& get_swapchain() { return s_current->m_swapchain; }
 	static const VkCommandPool& get_command_pool() { return s_current->m_command_pool; }
+	static const VkCommandPool& get_transfer_command_pool() { return s_current->m_transfer_command_pool; }
 	static const VkQueue& get_graphics_queue() { return s_current->m_graphics_queue; }
 	static const VkQueue& get_transfer_queue() { return s_current->m_transfer_queue; }
 	static allocator& get_memory_allocator() { return s_current->m_allocator; }
-
-	static bool recreate_swapchain(VkRenderPass render_pass) { return s_current->recreate_swapchain_impl(render_pass); }
-	static bool create_window_framebuffers(VkRenderPass render_pass) { return s_current->create_window_framebuffers_impl(render_pass); }
-
+	static pipeline_cache& get_pipeline_cache() { return s_current->m_pipeline_cache; }
+	static pipeline_registry& get_pipeline_registry() { return s_current->m_pipeline_registry; }
+	// every frame signals the next value on the graphics queue
+	static gpu_timeline& get_graphics_timeline() { return s_current->m_graphics_timeline; }
+	// destroys an object once the graphics queue has finished all work that was submitted or is being recorded
+	static void defer_destruction(deletion_queue::destroy_function destroy) { s_current->defer_destruction_impl(std::move(destroy)); }
+	static descriptor_layout_cache& get_descriptor_layout_cache() { return s_current->m_descriptor_layout_cache; }
+	// sets that live as long as the context
+	static descriptor_allocator& get_descriptor_allocator() { return s_current->m_descriptor_allocator; }
+	// sets that are only used by the current frame. They are freed when the frame index comes around again
+	static descriptor_allocator& get_frame_descriptor_allocator() { return s_current->m_frames[s_current->m_frame_index].descriptors; }
+
+	// with a render pass and a depth format the context also owns a depth image of the swapchain extent. It is recreated
+	// with the swapchain and is the second attachment of the window framebuffers, after the swapchain image
+	static bool recreate_swapchain(VkRenderPass render_pass, VkFormat depth_format = VK_FORMAT_UNDEFINED) { return s_current->recreate_swapchain_impl(render_pass, depth_format); }
+	static bool create_window_framebuffers(VkRenderPass render_pass, VkFormat depth_format = VK_FORMAT_UNDEFINED) { return s_current->create_window_framebuffers_impl(render_pass, depth_format); }
+
+	// only exists if create_window_framebuffers was called with a render pass
 	static const framebuffer& get_current_framebuffer() { return s_current->m_window_framebuffers[s_current->m_current_image_index]; }
+	// the image of the frame and its view, for dynamic rendering with command_buffer::begin_rendering.
+	// The view changes when the swapchain is recreated
+	static VkImage get_current_image() { return s_current->m_swapchain.images[s_current->m_current_image_index]; }
+	static VkImageView get_current_image_view() { return s_current->m_swapchain_image_views[s_current->m_current_image_index]; }
+	// only exists if the window framebuffers were created with a render pass and a depth format. All frames share it
+	static const image_info& get_depth_image() { return s_current->m_depth_image; }
+	static VkImageView get_depth_image_view() { return s_current->m_depth_image_view; }
 
 	static void set_framebuffer_change_callback(framebuffer_change_callback callback) { s_current->m_framebuffer_change_callback = callback; }
 
 	static const queue_family_indices& get_queue_families() { return s_current->m_queue_family_indices; }
+	static const device_features& get_device_features() { return s_current->m_device_features; }
+
+	// headless contexts have no surface. They render into offscreen images that take the place of the swapchain images.
+	// Those images end up in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL so they can be read back
+	static bool is_headless() { return s_current->m_surface.surface == VK_NULL_HANDLE; }
 
 	static VkResult begin_frame(uint32_t* image_index) { return s_current->begin_frame_impl(image_index); }
 
 	static VkResult end_frame(VkSemaphore wait_semaphore) { return s_current->end_frame_impl(wait_semaphore); }
 
 	static uint32_t current_image_index() { return s_current->m_current_image_index; }
+	// index of the per frame resources of the current frame. Cycles through [0, get_frames_in_flight())
+	static uint32_t current_frame_index() { return s_current->m_frame_index; }
+	static uint32_t get_frames_in_flight() { return (uint32_t)s_current->m_frames.size(); }
 
-	static VkSemaphore get_acquired_semaphore() { return s_current->m_acquired_semaphore; }
-	static VkFence get_in_flight_fence() { return s_current->m_in_flight_fence; }
+	// synchronization objects of the current frame
+	static VkSemaphore get_acquired_semaphore() { return s_current->m_frames[s_current->m_frame_index].acquired_semaphore; }
+	static VkSemaphore get_render_finished_semaphore() { return s_current->m_frames[s_current->m_frame_index].render_finished_semaphore; }
+	static VkFence get_in_flight_fence() { return s_current->m_frames[s_current->m_frame_index].in_flight_fence; }
 
 private:
-	bool recreate_swapchain_impl(VkRenderPass render_pass);
+	bool recreate_swapchain_impl(VkRenderPass render_pass, VkFormat depth_format);
+	void defer_destruction_impl(deletion_queue::destroy_function destroy);
 
 	VkResult begin_frame_impl(uint32_t* image_index);
 	VkResult end_frame_impl(VkSemaphore wait_semaphore);
 
 	
-	bool init(window_handle_t handle);
+	bool init(window_handle_t handle, uint32_t frames_in_flight);
 	bool create_surface(window_handle_t handle);
 
 	bool select_physical_device(const std::vector<const char*>& extensions);
 	bool create_logical_device(const std::vector<const char*>& extensions);
 	bool create_swapchain();
+	bool create_swapchain_image_views();
+	bool create_offscreen_images();
+	void destroy_offscreen_images();
+	bool create_frame_data(uint32_t frames_in_flight);
 	bool create_command_pool();
-	bool create_window_framebuffers_impl(VkRenderPass render_pass);
+	bool create_window_framebuffers_impl(VkRenderPass render_pass, VkFormat depth_format);
+	bool create_depth_image(VkFormat format);
+	void destroy_depth_image();
 
 
 	framebuffer_change_callback m_framebuffer_change_callback;
 	static context* s_current;
 	surface m_surface{};
 	swapchain m_swapchain{};
+	// used instead of the swapchain when there is no surface. The extent is set by create_surface
+	std::vector<image_info> m_offscreen_images;
+	std::vector<VkImageView> m_swapchain_image_views;
+	VkExtent2D m_offscreen_extent{};
+	image_info m_depth_image;
+	VkImageView m_depth_image_view = VK_NULL_HANDLE;
 
 	VkPhysicalDevice m_physical_device = VK_NULL_HANDLE;
 	VkDevice m_device = VK_NULL_HANDLE;
@@ -97,15 +157,32 @@ private:
 	VkQueue m_graphics_queue = VK_NULL_HANDLE;
 
 	VkCommandPool m_command_pool = VK_NULL_HANDLE;
+	VkCommandPool m_transfer_command_pool = VK_NULL_HANDLE;
 	queue_family_indices m_queue_family_indices;
+	device_features m_device_features;
 
 	framebuffer* m_window_framebuffers = NULL;
 
 	allocator m_allocator;
+	pipeline_cache m_pipeline_cache;
+	pipeline_registry m_pipeline_registry;
+	gpu_timeline m_graphics_timeline;
+	deletion_queue m_deletion_queue;
+	descriptor_layout_cache m_descriptor_layout_cache;
+	descriptor_allocator m_descriptor_allocator;
+
+	struct frame_data {
+		VkFence in_flight_fence = VK_NULL_HANDLE; // signaled when the gpu finished the frame
+		VkSemaphore acquired_semaphore = VK_NULL_HANDLE;
+		VkSemaphore render_finished_semaphore = VK_NULL_HANDLE;
+		descriptor_allocator descriptors; // reset once the fence has signaled
+	};
 
 	uint32_t m_current_image_index;
-	VkSemaphore m_acquired_semaphore = VK_NULL_HANDLE;
-	VkFence m_in_flight_fence = VK_NULL_HANDLE;
+	uint32_t m_frame_index = 0;
+	std::vector<frame_data> m_frames;
+	// fence of the frame that last rendered to the swapchain image. Images can be acquired out of order
+	std::vector<VkFence> m_images_in_flight;
 
 
 };
@@ -0,0 +1,161 @@
+#include "culling_pass.h"
+#include "context.h"
+#include "pipeline.h"
+#include <math.h>
+
+bool culling_pass::initialize(VkShaderModule culling_shader, uint32_t max_objects) {
+	m_max_objects = max_objects;
+	if (!create_buffer(m_objects, (size_t)max_objects * sizeof(object), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false))
+		return false;
+	if (!create_buffer(m_draw_objects, (size_t)max_objects * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, false))
+		return false;
+	m_draws = indirect_buffer::create();
+	if (!m_draws->reserve(max_objects))
+		return false;
+
+	VkDescriptorSetLayoutBinding bindings[3] = {};
+	for (uint32_t i = 0; i < 3; i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[i].pImmutableSamplers = NULL;
+	}
+	m_set_layout = context::get_descriptor_layout_cache().create_layout(bindings, 3);
+	if (m_set_layout == VK_NULL_HANDLE)
+		return false;
+
+	// the buffers never change, so a single set is written once.
+	// The long lived descriptor allocator cannot free single sets, so the pass brings a pool of the exact size
+	VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 };
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.pNext = NULL;
+	pool_info.flags = 0;
+	pool_info.maxSets = 1;
+	pool_info.poolSizeCount = 1;
+	pool_info.pPoolSizes = &pool_size;
+	if (vkCreateDescriptorPool(context::get_device(), &pool_info, NULL, &m_descriptor_pool) != VK_SUCCESS) {
+		m_descriptor_pool = VK_NULL_HANDLE;
+		return false;
+	}
+	VkDescriptorSetAllocateInfo allocate_info = {};
+	allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocate_info.pNext = NULL;
+	allocate_info.descriptorPool = m_descriptor_pool;
+	allocate_info.descriptorSetCount = 1;
+	allocate_info.pSetLayouts = &m_set_layout;
+	if (vkAllocateDescriptorSets(context::get_device(), &allocate_info, &m_descriptor_set) != VK_SUCCESS)
+		return false;
+	descriptor_writer writer;
+	writer.write_buffer(0, m_objects.handle, 0, VK_WHOLE_SIZE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+		.write_buffer(1, m_draws->get_handle(), 0, VK_WHOLE_SIZE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+		.write_buffer(2, m_draw_objects.handle, 0, VK_WHOLE_SIZE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+		.update(m_descriptor_set);
+
+	compute_pipeline_builder builder;
+	builder.set_shader(culling_shader);
+	builder.add_descriptor_set_layout(m_set_layout);
+	builder.push_constant<push_constants>(0);
+	builder.build(&m_pipeline, &m_layout);
+	return m_pipeline != VK_NULL_HANDLE;
+}
+
+void culling_pass::destroy() {
+	// the layout belongs to the layout cache. Frames in flight may still use the set
+	m_set_layout = VK_NULL_HANDLE;
+	if (m_descriptor_pool != VK_NULL_HANDLE) {
+		VkDevice device = context::get_device();
+		VkDescriptorPool pool = m_descriptor_pool;
+		context::defer_destruction([device, pool]() { vkDestroyDescriptorPool(device, pool, NULL); });
+	}
+	m_descriptor_pool = VK_NULL_HANDLE;
+	m_descriptor_set = VK_NULL_HANDLE;
+
+	destroy_buffer(m_objects);
+	destroy_buffer(m_draw_objects);
+	if (m_draws)
+		m_draws->destroy();
+	m_draws = NULL;
+	// owned by the pipeline registry
+	m_pipeline = VK_NULL_HANDLE;
+	m_layout = VK_NULL_HANDLE;
+	m_object_count = 0;
+	m_max_objects = 0;
+}
+
+bool culling_pass::set_objects(std::shared_ptr<staging_buffer> staging, const object* objects, uint32_t count) {
+	if (count > m_max_objects)
+		return false;
+	// the compute shader of frames in flight may still read the objects
+	if (count > 0 && !staging->update(m_objects.handle, 0, objects, (VkDeviceSize)count * sizeof(object)))
+		return false;
+	m_object_count = count;
+	return true;
+}
+
+// Gribb and Hartmann. Row i of the matrix is (m[i], m[4 + i], m[8 + i], m[12 + i])
+void culling_pass::extract_frustum_planes(const float m[16], float planes[6][4]) {
+	for (int i = 0; i < 4; i++) {
+		float row0 = m[i * 4 + 0], row1 = m[i * 4 + 1], row2 = m[i * 4 + 2], row3 = m[i * 4 + 3];
+		planes[0][i] = row3 + row0; // left
+		planes[1][i] = row3 - row0; // right
+		planes[2][i] = row3 + row1; // bottom
+		planes[3][i] = row3 - row1; // top
+		planes[4][i] = row2;        // near. Depth starts at 0
+		planes[5][i] = row3 - row2; // far
+	}
+	for (int p = 0; p < 6; p++) {
+		float length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+		if (length > 0.0f) {
+			for (int i = 0; i < 4; i++)
+				planes[p][i] /= length;
+		}
+	}
+}
+
+void culling_pass::record(command_buffer& cmd_buf, const float view_projection[16]) {
+	VkCommandBuffer cmd = cmd_buf.get_handle();
+	VkBuffer draws = m_draws->get_handle();
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = draws;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	// the draws of the previous frame read the commands and object indices before they are overwritten.
+	// The chain through the transfer stage also keeps the dispatch behind them
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+	uint32_t zero = 0;
+	vkCmdUpdateBuffer(cmd, draws, indirect_buffer::COUNT_OFFSET, sizeof(zero), &zero);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+
+	push_constants constants;
+	extract_frustum_planes(view_projection, constants.planes);
+	constants.object_count = m_object_count;
+	constants.use_first_instance = context::get_device_features().draw_indirect_first_instance ? 1 : 0;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_layout, 0, 1, &m_descriptor_set, 0, NULL);
+	vkCmdPushConstants(cmd, m_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	if (m_object_count > 0)
+		vkCmdDispatch(cmd, compute_pipeline_builder::group_count(m_object_count, GROUP_SIZE), 1, 1);
+
+	// the draws read the commands and the count, and the vertex shaders the object indices
+	VkBufferMemoryBarrier after[2] = { barrier, barrier };
+	after[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	after[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	after[1].buffer = m_draw_objects.handle;
+	after[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	after[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, NULL, 2, after, 0, NULL);
+}
@@ -0,0 +1,68 @@
+#ifndef ENGINE_RENDERER_CULLING_PASS_H
+#define ENGINE_RENDERER_CULLING_PASS_H
+
+#include <vulkan/vulkan.h>
+#include <memory>
+#include "buffer.h"
+#include "command_buffer.h"
+
+/*
+* Frustum culling on the gpu.
+* A compute shader tests the bounding sphere of every object against the camera frustum and appends a draw command
+* for each visible object to an indirect_buffer, which is then drawn with indirect_buffer::draw_count.
+* The first instance of every command is the index of the object, so per object data can come from an instance buffer.
+* That needs the drawIndirectFirstInstance device feature. Without it the first instance is 0, and vertex shaders
+* find the object through get_draw_objects(), which holds the object index of every command, read with gl_DrawID.
+* The shader source is sandbox/res/culling_shader.glsl.
+*/
+class culling_pass {
+public:
+	static constexpr uint32_t GROUP_SIZE = 64;
+
+	// matches the object struct of the shader
+	struct object {
+		float sphere[4]; // world space center and radius
+		uint32_t index_count;
+		uint32_t first_index;
+		int32_t vertex_offset;
+		uint32_t padding;
+	};
+
+	bool initialize(VkShaderModule culling_shader, uint32_t max_objects);
+	void destroy();
+
+	// replaces all objects. At most max_objects
+	bool set_objects(std::shared_ptr<staging_buffer> staging, const object* objects, uint32_t count);
+
+	// records the culling dispatch and the barriers around it. Has to be recorded outside of a render pass.
+	// view_projection is a column major matrix with depth in [0, 1] like the ones from glm
+	void record(command_buffer& cmd_buf, const float view_projection[16]);
+
+	// the visible objects after record. Drawn with draw_count
+	const std::shared_ptr<indirect_buffer>& get_draws() const { return m_draws; }
+	// one uint per draw command with the index of its object. Bound as a storage buffer
+	const VkBuffer& get_draw_objects() const { return m_draw_objects.handle; }
+
+private:
+	struct push_constants {
+		float planes[6][4];
+		uint32_t object_count;
+		uint32_t use_first_instance; // the object index goes into the first instance of the commands
+	};
+	static void extract_frustum_planes(const float m[16], float planes[6][4]);
+
+	VkPipeline m_pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout m_layout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout m_set_layout = VK_NULL_HANDLE;
+	// the pass owns the pool of its set, so the set is freed with the pass
+	VkDescriptorPool m_descriptor_pool = VK_NULL_HANDLE;
+	VkDescriptorSet m_descriptor_set = VK_NULL_HANDLE;
+
+	buffer_info m_objects{};
+	buffer_info m_draw_objects{};
+	uint32_t m_object_count = 0;
+	uint32_t m_max_objects = 0;
+	std::shared_ptr<indirect_buffer> m_draws;
+};
+
+#endif //ENGINE_RENDERER_CULLING_PASS_H
@@ -0,0 +1,21 @@
+#include "deletion_queue.h"
+
+void deletion_queue::push(uint64_t timeline_value, destroy_function destroy) {
+	// values are pushed in order almost always. An older value is moved up, which only destroys the object a bit later
+	if (!m_entries.empty() && timeline_value < m_entries.back().timeline_value)
+		timeline_value = m_entries.back().timeline_value;
+	m_entries.push_back({ timeline_value, std::move(destroy) });
+}
+
+void deletion_queue::collect(uint64_t completed_value) {
+	while (!m_entries.empty() && m_entries.front().timeline_value <= completed_value) {
+		// destroying may push new entries, so it is taken off the queue first
+		destroy_function destroy = std::move(m_entries.front().destroy);
+		m_entries.pop_front();
+		destroy();
+	}
+}
+
+void deletion_queue::flush() {
+	collect(UINT64_MAX);
+}
@@ -0,0 +1,34 @@
+#ifndef ENGINE_RENDERER_DELETION_QUEUE_H
+#define ENGINE_RENDERER_DELETION_QUEUE_H
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+
+/*
+* Destroys objects once the gpu timeline has passed the last submission that used them,
+* instead of waiting for the whole device to become idle.
+*/
+class deletion_queue {
+public:
+	using destroy_function = std::function<void()>;
+
+	// calls destroy once the timeline has reached the value
+	void push(uint64_t timeline_value, destroy_function destroy);
+	// runs the destroy functions of all values up to and including completed_value. Called once per frame
+	void collect(uint64_t completed_value);
+	// runs all destroy functions. The device has to be idle
+	void flush();
+
+	size_t size() const { return m_entries.size(); }
+
+private:
+	struct entry {
+		uint64_t timeline_value;
+		destroy_function destroy;
+	};
+	// sorted by the timeline value
+	std::deque<entry> m_entries;
+};
+
+#endif //ENGINE_RENDERER_DELETION_QUEUE_H
@@ -0,0 +1,212 @@
+#include "descriptor.h"
+#include "context.h"
+#include "engine/core/log.h"
+#include <algorithm>
+#include <assert.h>
+
+template<typename T>
+static void append(std::string& key, const T& value) {
+	key.append((const char*)&value, sizeof(T));
+}
+
+VkDescriptorSetLayout descriptor_layout_cache::create_layout(const VkDescriptorSetLayoutBinding* bindings, uint32_t binding_count) {
+	std::vector<VkDescriptorSetLayoutBinding> sorted(bindings, bindings + binding_count);
+	std::sort(sorted.begin(), sorted.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+		return a.binding < b.binding;
+	});
+
+	std::string key;
+	append(key, binding_count);
+	for (const VkDescriptorSetLayoutBinding& binding : sorted) {
+		append(key, binding.binding);
+		append(key, binding.descriptorType);
+		append(key, binding.descriptorCount);
+		append(key, binding.stageFlags);
+		if (binding.pImmutableSamplers != NULL) {
+			for (uint32_t i = 0; i < binding.descriptorCount; i++)
+				append(key, binding.pImmutableSamplers[i]);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_layouts.find(key);
+	if (it != m_layouts.end())
+		return it->second;
+
+	VkDescriptorSetLayoutCreateInfo create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.bindingCount = binding_count;
+	create_info.pBindings = sorted.data();
+
+	VkDescriptorSetLayout layout;
+	if (vkCreateDescriptorSetLayout(m_device, &create_info, NULL, &layout) != VK_SUCCESS) {
+		err("Failed to create descriptor set layout\n");
+		return VK_NULL_HANDLE;
+	}
+	m_layouts.emplace(std::move(key), layout);
+	return layout;
+}
+
+size_t descriptor_layout_cache::layout_count() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_layouts.size();
+}
+
+void descriptor_layout_cache::destroy() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto& [key, layout] : m_layouts)
+		vkDestroyDescriptorSetLayout(m_device, layout, NULL);
+	m_layouts.clear();
+}
+
+
+void descriptor_allocator::initialize(VkDevice device, uint32_t sets_per_pool) {
+	m_device = device;
+	m_sets_per_pool = std::min(std::max(sets_per_pool, 1u), MAX_SETS_PER_POOL);
+}
+
+void descriptor_allocator::destroy() {
+	for (VkDescriptorPool pool : m_used_pools)
+		vkDestroyDescriptorPool(m_device, pool, NULL);
+	for (VkDescriptorPool pool : m_free_pools)
+		vkDestroyDescriptorPool(m_device, pool, NULL);
+	m_used_pools.clear();
+	m_free_pools.clear();
+	m_current_pool = VK_NULL_HANDLE;
+}
+
+// descriptors per set of each type. Pools are sized for sets that mostly hold buffers and textures
+static const struct {
+	VkDescriptorType type;
+	float per_set;
+} s_pool_ratios[] = {
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 0.5f },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f },
+};
+
+VkDescriptorPool descriptor_allocator::create_pool(uint32_t set_count) {
+	constexpr uint32_t type_count = sizeof(s_pool_ratios) / sizeof(s_pool_ratios[0]);
+	VkDescriptorPoolSize sizes[type_count];
+	for (uint32_t i = 0; i < type_count; i++) {
+		sizes[i].type = s_pool_ratios[i].type;
+		sizes[i].descriptorCount = std::max((uint32_t)(s_pool_ratios[i].per_set * set_count), 1u);
+	}
+
+	VkDescriptorPoolCreateInfo create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.maxSets = set_count;
+	create_info.poolSizeCount = type_count;
+	create_info.pPoolSizes = sizes;
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(m_device, &create_info, NULL, &pool) != VK_SUCCESS)
+		return VK_NULL_HANDLE;
+	return pool;
+}
+
+VkDescriptorPool descriptor_allocator::grab_pool() {
+	if (!m_free_pools.empty()) {
+		VkDescriptorPool pool = m_free_pools.back();
+		m_free_pools.pop_back();
+		return pool;
+	}
+	VkDescriptorPool pool = create_pool(m_sets_per_pool);
+	m_sets_per_pool = std::min(m_sets_per_pool * 2, MAX_SETS_PER_POOL);
+	return pool;
+}
+
+bool descriptor_allocator::allocate(VkDescriptorSetLayout layout, VkDescriptorSet* set) {
+	assert(m_device != VK_NULL_HANDLE && "descriptor_allocator::initialize has not been called");
+	VkDescriptorSetAllocateInfo allocate_info = {};
+	allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocate_info.pNext = NULL;
+	allocate_info.descriptorSetCount = 1;
+	allocate_info.pSetLayouts = &layout;
+
+	if (m_current_pool != VK_NULL_HANDLE) {
+		allocate_info.descriptorPool = m_current_pool;
+		VkResult res = vkAllocateDescriptorSets(m_device, &allocate_info, set);
+		if (res == VK_SUCCESS)
+			return true;
+		// only an exhausted pool is worth a retry with the next one
+		if (res != VK_ERROR_OUT_OF_POOL_MEMORY && res != VK_ERROR_FRAGMENTED_POOL)
+			return false;
+	}
+
+	m_current_pool = grab_pool();
+	if (m_current_pool == VK_NULL_HANDLE) {
+		err("Failed to create descriptor pool\n");
+		return false;
+	}
+	m_used_pools.push_back(m_current_pool);
+
+	allocate_info.descriptorPool = m_current_pool;
+	return vkAllocateDescriptorSets(m_device, &allocate_info, set) == VK_SUCCESS;
+}
+
+void descriptor_allocator::reset() {
+	for (VkDescriptorPool pool : m_used_pools) {
+		vkResetDescriptorPool(m_device, pool, 0);
+		m_free_pools.push_back(pool);
+	}
+	m_used_pools.clear();
+	m_current_pool = VK_NULL_HANDLE;
+}
+
+
+VkWriteDescriptorSet& descriptor_writer::next_write(uint32_t binding, VkDescriptorType type) {
+	assert(m_write_count < MAX_WRITES && "too many descriptors in one descriptor_writer");
+	VkWriteDescriptorSet& write = m_writes[m_write_count];
+	write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.pNext = NULL;
+	write.dstBinding = binding;
+	write.dstArrayElement = 0;
+	write.descriptorCount = 1;
+	write.descriptorType = type;
+	return write;
+}
+
+descriptor_writer& descriptor_writer::write_buffer(uint32_t binding, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range, VkDescriptorType type) {
+	next_write(binding, type);
+	VkDescriptorBufferInfo& info = m_buffer_infos[m_write_count++];
+	info.buffer = buffer;
+	info.offset = offset;
+	info.range = range;
+	return *this;
+}
+
+descriptor_writer& descriptor_writer::write_image(uint32_t binding, VkImageView view, VkSampler sampler, VkImageLayout layout, VkDescriptorType type) {
+	next_write(binding, type);
+	VkDescriptorImageInfo& info = m_image_infos[m_write_count++];
+	info.sampler = sampler;
+	info.imageView = view;
+	info.imageLayout = layout;
+	return *this;
+}
+
+void descriptor_writer::update(VkDescriptorSet set) {
+	// the info pointers are set here, so a copied writer stays valid
+	for (uint32_t i = 0; i < m_write_count; i++) {
+		VkWriteDescriptorSet& write = m_writes[i];
+		write.dstSet = set;
+		bool is_image = write.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER || write.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+			|| write.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE || write.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+			|| write.descriptorType == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		write.pImageInfo = is_image ? &m_image_infos[i] : NULL;
+		write.pBufferInfo = is_image ? NULL : &m_buffer_infos[i];
+	}
+	if (m_write_count > 0)
+		vkUpdateDescriptorSets(context::get_device(), m_write_count, m_writes, 0, NULL);
+	m_write_count = 0;
+}
@@ -0,0 +1,89 @@
+#ifndef ENGINE_RENDERER_DESCRIPTOR_H
+#define ENGINE_RENDERER_DESCRIPTOR_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+/*
+* Owns all descriptor set layouts. A layout is looked up by its bindings,
+* so identical layouts are created once and are shared by every pipeline and set that uses them.
+* The cache can be used from several threads.
+*/
+class descriptor_layout_cache {
+public:
+	void initialize(VkDevice device) { m_device = device; }
+	// the bindings may be in any order. The layout is owned by the cache
+	VkDescriptorSetLayout create_layout(const VkDescriptorSetLayoutBinding* bindings, uint32_t binding_count);
+	VkDescriptorSetLayout create_layout(const std::vector<VkDescriptorSetLayoutBinding>& bindings) { return create_layout(bindings.data(), (uint32_t)bindings.size()); }
+
+	size_t layout_count() const;
+
+	// destroys all layouts
+	void destroy();
+private:
+	VkDevice m_device = VK_NULL_HANDLE;
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, VkDescriptorSetLayout> m_layouts;
+};
+
+/*
+* Allocates descriptor sets from a growing list of pools. When a pool is exhausted the next one is taken
+* and every new pool holds twice as many sets as the previous one, up to MAX_SETS_PER_POOL.
+* reset frees all sets at once and keeps the pools, so an allocator that is reset every frame stops creating pools
+* after the first frames. Not thread safe, every thread needs its own allocator.
+*/
+class descriptor_allocator {
+public:
+	static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+	void initialize(VkDevice device, uint32_t sets_per_pool = 64);
+	void destroy();
+
+	bool allocate(VkDescriptorSetLayout layout, VkDescriptorSet* set);
+	// all sets of the allocator become invalid. The gpu must not use them anymore
+	void reset();
+
+	size_t pool_count() const { return m_used_pools.size() + m_free_pools.size(); }
+
+private:
+	VkDescriptorPool grab_pool();
+	VkDescriptorPool create_pool(uint32_t set_count);
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	uint32_t m_sets_per_pool = 0;
+	VkDescriptorPool m_current_pool = VK_NULL_HANDLE;
+	// pools that have sets in them, including the current one
+	std::vector<VkDescriptorPool> m_used_pools;
+	std::vector<VkDescriptorPool> m_free_pools;
+};
+
+/*
+* Collects the descriptors of a set and writes them with a single vkUpdateDescriptorSets.
+* It uses fixed arrays, so writing sets does not allocate.
+*/
+class descriptor_writer {
+public:
+	static constexpr uint32_t MAX_WRITES = 16;
+
+	descriptor_writer& write_buffer(uint32_t binding, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range, VkDescriptorType type);
+	descriptor_writer& write_image(uint32_t binding, VkImageView view, VkSampler sampler, VkImageLayout layout, VkDescriptorType type);
+
+	// writes the collected descriptors into the set and clears the writer
+	void update(VkDescriptorSet set);
+	void clear() { m_write_count = 0; }
+
+private:
+	VkWriteDescriptorSet& next_write(uint32_t binding, VkDescriptorType type);
+
+	// write i uses buffer info i or image info i
+	VkWriteDescriptorSet m_writes[MAX_WRITES];
+	VkDescriptorBufferInfo m_buffer_infos[MAX_WRITES];
+	VkDescriptorImageInfo m_image_infos[MAX_WRITES];
+	uint32_t m_write_count = 0;
+};
+
+#endif //ENGINE_RENDERER_DESCRIPTOR_H
@@ -3,26 +3,17 @@
 
 
 bool framebuffer::add_color_attachment(VkImage image, VkFormat format) {
-	VkImageViewCreateInfo view_create_info = { };
-	view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	view_create_info.pNext = NULL;
-	view_create_info.flags = 0;
-	view_create_info.image = image;
-	view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	view_create_info.format = format;
-	view_create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-	view_create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-	view_create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-	view_create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-
-	view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	view_create_info.subresourceRange.baseMipLevel = 0;
-	view_create_info.subresourceRange.levelCount = 1;
-	view_create_info.subresourceRange.baseArrayLayer = 0;
-	view_create_info.subresourceRange.layerCount = 1;
+	return add_attachment(image, format);
+}
+
+bool framebuffer::add_depth_stencil_attachment(VkImage image, VkFormat format) {
+	return add_attachment(image, format);
+}
 
+// the view picks the aspects from the format
+bool framebuffer::add_attachment(VkImage image, VkFormat format) {
 	VkImageView view;
-	if (vkCreateImageView(context::get_device(), &view_create_info, NULL, &view) != VK_SUCCESS)
+	if (!create_image_view(image, format, &view))
 		return false;
 	m_attachments.push_back(view);
 	return true;
@@ -50,5 +41,8 @@ bool framebuffer::create(VkRenderPass renderpass, uint32_t width, uint32_t heigh
 void framebuffer::destroy() {
 	for (VkImageView view : m_attachments)
 		vkDestroyImageView(context::get_device(), view, NULL);
-	vkDestroyFramebuffer(context::get_device(), m_handle, NULL);
+	m_attachments.clear();
+	if (m_handle != VK_NULL_HANDLE)
+		vkDestroyFramebuffer(context::get_device(), m_handle, NULL);
+	m_handle = VK_NULL_HANDLE;
 }
\ No newline at end of file
@@ -6,9 +6,11 @@
 
 class framebuffer {
 public:
-	framebuffer() : m_width(0), m_height(0) {}
+	framebuffer() : m_handle(VK_NULL_HANDLE), m_width(0), m_height(0) {}
 	~framebuffer() { destroy(); }
+	// attachments are in the order of the render pass attachments
 	bool add_color_attachment(VkImage image, VkFormat format);
+	bool add_depth_stencil_attachment(VkImage image, VkFormat format);
 	bool create(VkRenderPass renderpass, uint32_t width, uint32_t height);
 
 
@@ -18,6 +20,8 @@ public:
 
 	void destroy();
 private:
+	bool add_attachment(VkImage image, VkFormat format);
+
 	VkFramebuffer m_handle;
 	uint32_t m_width;
 	uint32_t m_height;
@@ -0,0 +1,55 @@
+#include "gpu_timeline.h"
+
+bool gpu_timeline::create(VkDevice device) {
+	m_device = device;
+	m_submitted_value = 0;
+	m_completed_value = 0;
+
+	VkSemaphoreTypeCreateInfo type_info = {};
+	type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	type_info.pNext = NULL;
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	type_info.initialValue = 0;
+
+	VkSemaphoreCreateInfo create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	create_info.pNext = &type_info;
+	create_info.flags = 0;
+	return vkCreateSemaphore(device, &create_info, NULL, &m_semaphore) == VK_SUCCESS;
+}
+
+void gpu_timeline::destroy() {
+	if (m_semaphore != VK_NULL_HANDLE)
+		vkDestroySemaphore(m_device, m_semaphore, NULL);
+	m_semaphore = VK_NULL_HANDLE;
+}
+
+uint64_t gpu_timeline::completed_value() {
+	uint64_t value;
+	if (vkGetSemaphoreCounterValue(m_device, m_semaphore, &value) == VK_SUCCESS)
+		m_completed_value = value;
+	return m_completed_value;
+}
+
+bool gpu_timeline::is_complete(uint64_t value) {
+	if (value <= m_completed_value)
+		return true;
+	return value <= completed_value();
+}
+
+VkResult gpu_timeline::wait(uint64_t value, uint64_t timeout) {
+	if (value <= m_completed_value)
+		return VK_SUCCESS;
+
+	VkSemaphoreWaitInfo wait_info = {};
+	wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	wait_info.pNext = NULL;
+	wait_info.flags = 0;
+	wait_info.semaphoreCount = 1;
+	wait_info.pSemaphores = &m_semaphore;
+	wait_info.pValues = &value;
+	VkResult res = vkWaitSemaphores(m_device, &wait_info, timeout);
+	if (res == VK_SUCCESS && value > m_completed_value)
+		m_completed_value = value;
+	return res;
+}
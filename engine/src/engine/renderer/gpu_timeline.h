@@ -0,0 +1,38 @@
+#ifndef ENGINE_RENDERER_GPU_TIMELINE_H
+#define ENGINE_RENDERER_GPU_TIMELINE_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+/*
+* Progress of one queue, counted by a timeline semaphore.
+* Submissions signal increasing values. Everything a submission used is free once the semaphore reached its value.
+* A signal also waits for all work that was submitted to the queue before it,
+* so submissions that do not signal anything are covered by the next one that does.
+*/
+class gpu_timeline {
+public:
+	bool create(VkDevice device);
+	void destroy();
+
+	VkSemaphore get_handle() const { return m_semaphore; }
+
+	// reserves the value for a submission that is made now. It has to be signaled by that submission
+	uint64_t signal_next() { return ++m_submitted_value; }
+	// value of the next submission. Work that is recorded now is finished once it is reached
+	uint64_t pending_value() const { return m_submitted_value + 1; }
+	uint64_t submitted_value() const { return m_submitted_value; }
+
+	// the last value the gpu signaled
+	uint64_t completed_value();
+	bool is_complete(uint64_t value);
+	VkResult wait(uint64_t value, uint64_t timeout = UINT64_MAX);
+
+private:
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkSemaphore m_semaphore = VK_NULL_HANDLE;
+	uint64_t m_submitted_value = 0;
+	uint64_t m_completed_value = 0; // cached, so checks of old values do not go to the driver
+};
+
+#endif //ENGINE_RENDERER_GPU_TIMELINE_H
@@ -0,0 +1,172 @@
+#include "image.h"
+#include "buffer.h"
+#include "context.h"
+#include "synchronization.h"
+#include <string.h>
+
+
+bool create_image(image_info& info, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage) {
+	info.handle = VK_NULL_HANDLE;
+	info.memory = allocator::invalid_allocation;
+
+	VkImageCreateInfo create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.imageType = VK_IMAGE_TYPE_2D;
+	create_info.format = format;
+	create_info.extent = { width, height, 1 };
+	create_info.mipLevels = 1;
+	create_info.arrayLayers = 1;
+	create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	create_info.usage = usage;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	create_info.queueFamilyIndexCount = 0;
+	create_info.pQueueFamilyIndices = NULL;
+	create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(context::get_device(), &create_info, NULL, &info.handle) != VK_SUCCESS)
+		return false;
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(context::get_device(), info.handle, &requirements);
+
+	// optimal images must not share a bufferImageGranularity page with buffers
+	allocator& allocator = context::get_memory_allocator();
+	allocator::sub_allocation sub_allocation = allocator.allocate(requirements, allocator::access_flags::STATIC, allocator::tiling::OPTIMAL);
+	if (!sub_allocation) {
+		vkDestroyImage(context::get_device(), info.handle, NULL);
+		info.handle = VK_NULL_HANDLE;
+		return false;
+	}
+
+	if (vkBindImageMemory(context::get_device(), info.handle, sub_allocation.handle, sub_allocation.start_address) != VK_SUCCESS) {
+		allocator.free(sub_allocation);
+		vkDestroyImage(context::get_device(), info.handle, NULL);
+		info.handle = VK_NULL_HANDLE;
+		return false;
+	}
+
+	info.memory = sub_allocation;
+	info.format = format;
+	info.extent = { width, height };
+	return true;
+}
+
+void destroy_image(image_info& info) {
+	if (info.handle == VK_NULL_HANDLE && !info.memory)
+		return;
+	VkImage handle = info.handle;
+	allocator::sub_allocation memory = info.memory;
+	context::defer_destruction([handle, memory]() {
+		if (handle != VK_NULL_HANDLE)
+			vkDestroyImage(context::get_device(), handle, NULL);
+		if (memory)
+			context::get_memory_allocator().free(memory);
+	});
+	info.memory = allocator::invalid_allocation;
+	info.handle = VK_NULL_HANDLE;
+	info.extent = { 0, 0 };
+}
+
+static bool is_depth_format(VkFormat format) {
+	return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_X8_D24_UNORM_PACK32 || has_stencil_component(format);
+}
+
+bool create_image_view(VkImage image, VkFormat format, VkImageView* view) {
+	VkImageViewCreateInfo view_create_info = { };
+	view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_create_info.pNext = NULL;
+	view_create_info.flags = 0;
+	view_create_info.image = image;
+	view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_create_info.format = format;
+	view_create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	view_create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	view_create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	view_create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+	view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	if (is_depth_format(format)) {
+		view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		if (has_stencil_component(format))
+			view_create_info.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
+	view_create_info.subresourceRange.baseMipLevel = 0;
+	view_create_info.subresourceRange.levelCount = 1;
+	view_create_info.subresourceRange.baseArrayLayer = 0;
+	view_create_info.subresourceRange.layerCount = 1;
+
+	return vkCreateImageView(context::get_device(), &view_create_info, NULL, view) == VK_SUCCESS;
+}
+
+bool has_stencil_component(VkFormat format) {
+	return format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+VkFormat find_depth_format(bool stencil) {
+	// ordered by preference. D24 is not supported everywhere, D32 with stencil is larger
+	static const VkFormat depth_formats[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D16_UNORM };
+	for (VkFormat format : depth_formats) {
+		if (stencil && !has_stencil_component(format))
+			continue;
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(context::get_physical_device(), format, &properties);
+		if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+			return format;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+bool read_back_image(VkImage image, VkExtent2D extent, uint32_t texel_size, void* pixels) {
+	size_t n_bytes = (size_t)extent.width * extent.height * texel_size;
+	buffer_info readback{};
+	if (!create_buffer(readback, n_bytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, true))
+		return false;
+
+	command_buffer cmd_buf;
+	cmd_buf.start(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	// wait for the rendering that wrote the image
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(cmd_buf.get_handle(), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { extent.width, extent.height, 1 };
+	vkCmdCopyImageToBuffer(cmd_buf.get_handle(), image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.handle, 1, &region);
+
+	// make the copy visible to the host
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(cmd_buf.get_handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	cmd_buf.end();
+
+	VkFence fence = create_fence();
+	cmd_buf.submit(context::get_graphics_queue(), VK_NULL_HANDLE, VK_NULL_HANDLE, fence, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	bool success = vkWaitForFences(context::get_device(), 1, &fence, VK_TRUE, UINT64_MAX) == VK_SUCCESS;
+
+	allocator& allocator = context::get_memory_allocator();
+	if (success)
+		success = allocator.invalidate(readback.memory, 0, n_bytes);
+	if (success)
+		memcpy(pixels, readback.memory.mapped, n_bytes);
+
+	vkDestroyFence(context::get_device(), fence, NULL);
+	cmd_buf.destroy();
+	vkDestroyBuffer(context::get_device(), readback.handle, NULL);
+	allocator.free(readback.memory);
+	return success;
+}
@@ -0,0 +1,37 @@
+#ifndef ENGINE_RENDERER_IMAGE_H
+#define ENGINE_RENDERER_IMAGE_H
+
+#include <vulkan/vulkan.h>
+#include "memory.h"
+
+
+struct image_info {
+	image_info() : memory{}, format(VK_FORMAT_UNDEFINED), extent{ 0, 0 }, handle(VK_NULL_HANDLE) {}
+	allocator::sub_allocation memory;
+	VkFormat format;
+	VkExtent2D extent;
+
+	VkImage handle;
+};
+
+// creates a 2D image with optimal tiling in device local memory
+bool create_image(image_info& info, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage);
+// the image and its memory are destroyed once the gpu has finished the work that is submitted or being recorded
+void destroy_image(image_info& info);
+
+// a view of the first mip level and layer. Depth formats get the depth aspect and the stencil aspect if they have one
+bool create_image_view(VkImage image, VkFormat format, VkImageView* view);
+
+// true for the depth formats that also have a stencil component
+bool has_stencil_component(VkFormat format);
+
+// the first depth format the device can use as an optimally tiled depth attachment.
+// With stencil only depth formats that have a stencil component are considered. VK_FORMAT_UNDEFINED if there is none
+VkFormat find_depth_format(bool stencil = false);
+
+// copies the first mip level of a color image to the host and waits for the copy to finish.
+// The image must be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL and have been created with VK_IMAGE_USAGE_TRANSFER_SRC_BIT.
+// pixels must be able to hold width * height * texel_size bytes
+bool read_back_image(VkImage image, VkExtent2D extent, uint32_t texel_size, void* pixels);
+
+#endif //ENGINE_RENDERER_IMAGE_H
@@ -1,6 +1,8 @@
 #include "memory.h"
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
 #include "context.h"
 
 allocator::sub_allocation allocator::invalid_allocation = {};
@@ -12,105 +14,138 @@ void allocator::free(memory& memory, const sub_allocation& allocation) {
 	if (allocation.handle == VK_NULL_HANDLE)
 		return;
 	assert(allocation.memory_type_index == memory.memory_type_index);
+	assert(allocation.owner && allocation.handle == allocation.owner->handle);
 
-	for (auto it = memory.blocks.begin(); it != memory.blocks.end(); it++) {
-		memory_block& block = *it;
-		if (block.address == allocation.start_address) {
-			printf("free: [%d, %d): %d\n", (int)block.start(), (int)block.end(), (int) block.size);
-			memory.blocks.erase(it);
-			break;
-		}
-	}
-
-	if (memory.blocks.size() == 0) {
-		free(memory);
-	}
+	device_block* block = allocation.owner;
+	m_statistics.allocation_count--;
+	m_statistics.allocated_bytes -= tlsf::size(allocation.block);
+	m_statistics.requested_bytes -= allocation.size;
+	block->blocks.free(allocation.block);
 
+	// keep the empty block around for a while. It is likely to be reused soon
+	if (block->blocks.empty())
+		block->empty_since_frame = m_frame_index;
 }
 
 
-bool allocator::find_space(memory_block* space, size_t* index, const memory& memory, size_t size) {
-
-	for (size_t i = 0; i <= memory.blocks.size(); i++) {
-		
-
-		if (i == 0) {
-			space->address = 0;
-		}else {
-			space->address = memory.blocks[i - 1].end();
-		}
-
-		if (i == memory.blocks.size()) {
-			space->size = memory.size - space->address;
-		}else {
-			space->size = memory.blocks[i].start() - space->address;
-		}
-
-		
-		if (space->size >= size) {
-			*index = i;
-			return true;
+allocator::sub_allocation allocator::sub_allocate(memory& memory, VkDeviceSize size, VkDeviceSize alignment) {
+	tlsf::block_handle sub_block = NULL;
+	device_block* block = NULL;
+	for (device_block* candidate : memory.device_blocks) {
+		if (candidate->size < size)
+			continue;
+		sub_block = candidate->blocks.allocate(size, alignment);
+		if (sub_block != NULL) {
+			block = candidate;
+			break;
 		}
 	}
-	return false;
-}
 
-allocator::sub_allocation allocator::sub_allocate(memory& memory, size_t size) {
-	if (memory.handle == VK_NULL_HANDLE)
-		if (!initial_allocation(memory))
+	if (sub_block == NULL) {
+		// all blocks are full. Chain another one. It has to be large enough for the size class the
+		// allocation is searched in, not just for its size
+		block = allocate_device_block(memory, tlsf::required_capacity(size, alignment));
+		if (block == NULL)
 			return invalid_allocation;
 
-	if (size > memory.size)
-		return invalid_allocation;
-
-	memory_block space;
-	size_t insert_index;
-	if (find_space(&space, &insert_index, memory, size)) {
-		auto& blocks = memory.blocks;
-		space.size = size;
-		blocks.insert(blocks.begin() + insert_index, space);
-
-		sub_allocation allocated_memory;
-		allocated_memory.handle = memory.handle;
-		allocated_memory.memory_type_index = memory.memory_type_index;
-		allocated_memory.start_address = space.address;
-		printf("allocate: [%d, %d): %d\n", (int)space.start(), (int)space.end(), (int)space.size);
-		return sub_allocation{ memory.handle, memory.memory_type_index, space.address };
+		sub_block = block->blocks.allocate(size, alignment);
+		if (sub_block == NULL)
+			return invalid_allocation;
 	}
 
-	
-	return invalid_allocation;
+	m_statistics.allocation_count++;
+	m_statistics.allocated_bytes += tlsf::size(sub_block);
+	void* mapped = block->mapped ? (char*)block->mapped + tlsf::offset(sub_block) : NULL;
+	return sub_allocation{ block->handle, memory.memory_type_index, tlsf::offset(sub_block), size, mapped, sub_block, block };
 }
 
 
-VkDeviceSize align(VkDeviceSize size) {
-	VkDeviceSize mod = size % ALIGNMENT;
-	VkDeviceSize to_add = ALIGNMENT - mod;
+VkDeviceSize align(VkDeviceSize size, VkDeviceSize alignment) {
+	VkDeviceSize mod = size % alignment;
+	if (mod == 0)
+		return size;
+	VkDeviceSize to_add = alignment - mod;
 
-	assert((to_add + size) % ALIGNMENT == 0);
+	assert((to_add + size) % alignment == 0);
 	return size + to_add;
 }
 
-bool allocator::initial_allocation(memory& memory) {
-	VkDeviceSize allocate_size = m_default_allocation_size;
+allocator::device_block* allocator::allocate_device_block(memory& memory, VkDeviceSize min_size) {
+	VkDeviceSize allocate_size = memory.next_block_size;
 	VkDeviceSize two_third_heap_size = memory.heap_type_info.size * 2 / 3;
 	if (allocate_size > two_third_heap_size)
 		allocate_size = two_third_heap_size; // 66.66% of total heap size
+	if (allocate_size < min_size)
+		allocate_size = min_size; // oversized requests get a block of their own size
 	allocate_size = align(allocate_size);
 	assert(allocate_size % ALIGNMENT == 0);
 
 	VkMemoryAllocateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	info.pNext = NULL;
-	info.allocationSize = allocate_size;
 	info.memoryTypeIndex = memory.memory_type_index;
-	if (vkAllocateMemory(m_device, &info, NULL, &memory.handle) != VK_SUCCESS) {
-		memory.handle = NULL;
-		memory.size = 0;
-		return false;
+
+	// retry with smaller blocks if the heap is too fragmented for the preferred size
+	VkDeviceMemory handle = VK_NULL_HANDLE;
+	for (;;) {
+		info.allocationSize = allocate_size;
+		if (vkAllocateMemory(m_device, &info, NULL, &handle) == VK_SUCCESS)
+			break;
+		if (allocate_size / 2 < min_size)
+			return NULL;
+		allocate_size = align(allocate_size / 2);
+	}
+
+	// host visible memory is mapped once for the lifetime of the block
+	void* mapped = NULL;
+	if (memory.memory_type_info.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		if (vkMapMemory(m_device, handle, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+			vkFreeMemory(m_device, handle, NULL);
+			return NULL;
+		}
+	}
+
+	device_block* block = new device_block;
+	block->handle = handle;
+	block->size = allocate_size;
+	block->mapped = mapped;
+	block->blocks.initialize(allocate_size);
+	block->empty_since_frame = m_frame_index;
+	memory.device_blocks.push_back(block);
+	m_statistics.device_block_count++;
+	m_statistics.reserved_bytes += allocate_size;
+
+	// grow geometrically so the number of blocks stays small
+	if (memory.next_block_size < m_max_block_size)
+		memory.next_block_size *= 2;
+	return block;
+}
+
+void allocator::free_device_block(memory& memory, size_t index) {
+	device_block* block = memory.device_blocks[index];
+	m_statistics.device_block_count--;
+	m_statistics.reserved_bytes -= block->size;
+	if (block->mapped) {
+		// pending flushes of this block would reference freed memory
+		m_pending_flushes.erase(std::remove_if(m_pending_flushes.begin(), m_pending_flushes.end(),
+			[block](const VkMappedMemoryRange& range) { return range.memory == block->handle; }), m_pending_flushes.end());
+		vkUnmapMemory(m_device, block->handle);
+	}
+	vkFreeMemory(m_device, block->handle, NULL);
+	delete block;
+	memory.device_blocks.erase(memory.device_blocks.begin() + index);
+}
+
+void allocator::release_unused_blocks() {
+	m_frame_index++;
+	for (uint32_t i = 0; i < m_memory_type_count; i++) {
+		memory& mem = m_allocated_memory_types[i];
+		for (size_t b = mem.device_blocks.size(); b-- > 0;) {
+			device_block* block = mem.device_blocks[b];
+			if (block->blocks.empty() && m_frame_index - block->empty_since_frame > m_empty_block_grace_period)
+				free_device_block(mem, b);
+		}
 	}
-	memory.size = allocate_size;
-	return true;
 }
 
 void allocator::initialize(VkPhysicalDevice physical_device, VkDevice device) {
@@ -119,6 +154,12 @@ void allocator::initialize(VkPhysicalDevice physical_device, VkDevice device) {
 	vkGetPhysicalDeviceMemoryProperties(physical_device, &properties);
 	m_memory_type_count = properties.memoryTypeCount;
 
+	VkPhysicalDeviceProperties device_properties;
+	vkGetPhysicalDeviceProperties(physical_device, &device_properties);
+	m_buffer_image_granularity = device_properties.limits.bufferImageGranularity;
+	m_non_coherent_atom_size = device_properties.limits.nonCoherentAtomSize;
+	m_statistics = {};
+
 	for (uint32_t i = 0; i < m_memory_type_count; i++) {
 		memory& mem = m_allocated_memory_types[i];
 		mem.memory_type_index = i;
@@ -126,9 +167,9 @@ void allocator::initialize(VkPhysicalDevice physical_device, VkDevice device) {
 		mem.heap_type_info = properties.memoryHeaps[mem.memory_type_info.heapIndex];
 
 
-		// initialize later:
-		mem.size = 0;
-		mem.handle = VK_NULL_HANDLE;
+		// device blocks are allocated on demand
+		mem.device_blocks.clear();
+		mem.next_block_size = m_initial_block_size;
 	}
 
 	m_initialized = true;
@@ -163,12 +204,34 @@ allocator::memory* allocator::find_memory_type(uint32_t memory_type_bits, access
 
 
 allocator::sub_allocation allocator::allocate(size_t size, uint32_t memory_type_bits, access_flags access_flags) {
-	size = align(size);
-	memory* mem = find_memory_type(memory_type_bits, access_flags);
-	if (!mem)
+	VkMemoryRequirements requirements;
+	requirements.size = size;
+	requirements.alignment = ALIGNMENT;
+	requirements.memoryTypeBits = memory_type_bits;
+	return allocate(requirements, access_flags, tiling::LINEAR);
+}
+
+allocator::sub_allocation allocator::allocate(const VkMemoryRequirements& requirements, access_flags access_flags, tiling resource_tiling) {
+	memory* mem = find_memory_type(requirements.memoryTypeBits, access_flags);
+	if (!mem || requirements.size == 0)
 		return invalid_allocation;
 
-	return sub_allocate(*mem, size);
+	VkDeviceSize size = requirements.size;
+	VkDeviceSize alignment = requirements.alignment > 0 ? requirements.alignment : 1;
+
+	// optimal images get whole bufferImageGranularity pages.
+	// That way they never share a page with a linear resource and linear resources can be packed tightly
+	if (resource_tiling == tiling::OPTIMAL && m_buffer_image_granularity > alignment) {
+		alignment = m_buffer_image_granularity;
+		size = align(size, m_buffer_image_granularity);
+	}
+
+	sub_allocation allocation = sub_allocate(*mem, size, alignment);
+	if (allocation) {
+		allocation.size = requirements.size;
+		m_statistics.requested_bytes += requirements.size;
+	}
+	return allocation;
 }
 
 void allocator::free(const sub_allocation& allocation) {
@@ -176,12 +239,84 @@ void allocator::free(const sub_allocation& allocation) {
 		free(m_allocated_memory_types[allocation.memory_type_index], allocation);
 }
 void allocator::free(memory& memory) {
-	if (memory.handle != VK_NULL_HANDLE) {
-		vkFreeMemory(m_device, memory.handle, NULL);
-		memory.handle = VK_NULL_HANDLE;
-		memory.size = 0;
-		memory.blocks.clear();
+	while (!memory.device_blocks.empty())
+		free_device_block(memory, memory.device_blocks.size() - 1);
+	memory.next_block_size = m_initial_block_size;
+}
+
+void allocator::flush(const sub_allocation& allocation, VkDeviceSize offset, VkDeviceSize size) {
+	if (!allocation || allocation.owner == NULL || size == 0)
+		return;
+	const memory& mem = m_allocated_memory_types[allocation.memory_type_index];
+	if (mem.memory_type_info.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+		return;
+
+	// the range has to start and end at a multiple of nonCoherentAtomSize or at the end of the memory
+	VkDeviceSize begin = allocation.start_address + offset;
+	VkDeviceSize end = begin + size;
+	begin -= begin % m_non_coherent_atom_size;
+	end = align(end, m_non_coherent_atom_size);
+	if (end > allocation.owner->size)
+		end = allocation.owner->size;
+
+	VkMappedMemoryRange& range = m_pending_flushes.emplace_back();
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.pNext = NULL;
+	range.memory = allocation.handle;
+	range.offset = begin;
+	range.size = end - begin;
+}
+
+bool allocator::invalidate(const sub_allocation& allocation, VkDeviceSize offset, VkDeviceSize size) {
+	if (!allocation || allocation.owner == NULL || size == 0)
+		return true;
+	const memory& mem = m_allocated_memory_types[allocation.memory_type_index];
+	if (mem.memory_type_info.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+		return true;
+
+	// same rules for the range as for flushes
+	VkDeviceSize begin = allocation.start_address + offset;
+	VkDeviceSize end = begin + size;
+	begin -= begin % m_non_coherent_atom_size;
+	end = align(end, m_non_coherent_atom_size);
+	if (end > allocation.owner->size)
+		end = allocation.owner->size;
+
+	VkMappedMemoryRange range = {};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.pNext = NULL;
+	range.memory = allocation.handle;
+	range.offset = begin;
+	range.size = end - begin;
+	return vkInvalidateMappedMemoryRanges(m_device, 1, &range) == VK_SUCCESS;
+}
+
+bool allocator::flush_mapped_ranges() {
+	if (m_pending_flushes.empty())
+		return true;
+
+	// merge overlapping and touching ranges of the same memory
+	std::sort(m_pending_flushes.begin(), m_pending_flushes.end(), [](const VkMappedMemoryRange& a, const VkMappedMemoryRange& b) {
+		if (a.memory != b.memory)
+			return a.memory < b.memory;
+		return a.offset < b.offset;
+	});
+	size_t count = 0;
+	for (size_t i = 1; i < m_pending_flushes.size(); i++) {
+		VkMappedMemoryRange& last = m_pending_flushes[count];
+		const VkMappedMemoryRange& range = m_pending_flushes[i];
+		if (range.memory == last.memory && range.offset <= last.offset + last.size) {
+			VkDeviceSize end = std::max(last.offset + last.size, range.offset + range.size);
+			last.size = end - last.offset;
+		}else {
+			m_pending_flushes[++count] = range;
+		}
 	}
+	count++;
+
+	VkResult result = vkFlushMappedMemoryRanges(m_device, (uint32_t)count, m_pending_flushes.data());
+	m_pending_flushes.clear();
+	return result == VK_SUCCESS;
 }
 
 void allocator::destroy() {
@@ -198,36 +333,19 @@ void allocator::destroy() {
 void allocator::print_memory_leaks() {
 	for (uint32_t i = 0; i < m_memory_type_count; i++) {
 		memory& mem_type = m_allocated_memory_types[i];
-		if (mem_type.handle != VK_NULL_HANDLE) {
-			for (const memory_block& block : mem_type.blocks) {
-				fprintf(stdout, "leaked memory of memory type %d: buffer[%p, %p) with size% d\n", mem_type.memory_type_index, (void*)block.start(), (void*)block.end(), (int) block.size);
-			}
+		for (const device_block* block : mem_type.device_blocks) {
+			block->blocks.for_each_allocation([&](VkDeviceSize offset, VkDeviceSize size) {
+				fprintf(stdout, "leaked memory of memory type %d: buffer[%p, %p) with size% d\n", mem_type.memory_type_index, (void*)offset, (void*)(offset + size), (int) size);
+			});
 		}
 	}
 }
 
 bool memory::memcpy_host_to_device(const allocator::sub_allocation& memory, size_t offset, const void* data, size_t size) {
-	VkPhysicalDeviceProperties props;
-	vkGetPhysicalDeviceProperties(context::get_physical_device(), &props);
-
-	VkDeviceSize d_size = size;
-	d_size = align(size);
-
-	void* mapped;
-	if (vkMapMemory(context::get_device(), memory.handle, memory.start_address + offset, d_size, 0, &mapped) != VK_SUCCESS)
-		return false;
-	memcpy(mapped, data, size);
-	VkMappedMemoryRange range;
-	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-	range.pNext = NULL;
-	range.memory = memory.handle;
-	range.offset = memory.start_address + offset;
-	range.size = d_size;
-
-	if (vkFlushMappedMemoryRanges(context::get_device(), 1, &range) != VK_SUCCESS)
+	if (memory.mapped == NULL)
 		return false;
 
-
-	vkUnmapMemory(context::get_device(), memory.handle);
+	memcpy((char*)memory.mapped + offset, data, size);
+	context::get_memory_allocator().flush(memory, offset, size);
 	return true;
 }
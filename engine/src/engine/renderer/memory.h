@@ -4,11 +4,13 @@
 #include <vulkan/vulkan.h>
 #include <vector>
 #include <array>
+#include "tlsf.h"
 
 #define ALIGNMENT (256)
-VkDeviceSize align(VkDeviceSize size);
+VkDeviceSize align(VkDeviceSize size, VkDeviceSize alignment = ALIGNMENT);
 
 class allocator {
+	struct device_block;
 public:
 
 	allocator() : m_initialized(false) { }
@@ -18,21 +20,49 @@ public:
 		DYNAMIC = 2
 	};
 
+	// buffers and linear images must not share a bufferImageGranularity page with optimal images
+	enum class tiling {
+		LINEAR, OPTIMAL
+	};
+
+	struct statistics {
+		size_t device_block_count;
+		size_t allocation_count;
+		VkDeviceSize reserved_bytes; // size of all VkDeviceMemory blocks
+		VkDeviceSize allocated_bytes; // bytes taken by sub allocations including size rounding
+		VkDeviceSize requested_bytes; // bytes that were actually requested
+
+		// sizes rounded up to whole bufferImageGranularity pages. The alignment padding in front of an allocation
+		// is not counted, it stays free and can be handed out to other allocations
+		VkDeviceSize wasted_rounding() const { return allocated_bytes - requested_bytes; }
+		// fraction of the reserved device memory that holds requested data
+		float efficiency() const { return reserved_bytes > 0 ? (float)((double)requested_bytes / (double)reserved_bytes) : 1.0f; }
+	};
+
 
 	// Contains all the data needed to bind to a buffer
 	struct sub_allocation {
-		sub_allocation() : memory_type_index(0xFFFFFFFF), handle(VK_NULL_HANDLE), start_address(0) {}
-		sub_allocation(VkDeviceMemory memory, uint32_t memory_type, VkDeviceAddress address) 
-				: memory_type_index(memory_type), handle(memory), start_address(address){}
+		sub_allocation() : memory_type_index(0xFFFFFFFF), handle(VK_NULL_HANDLE), start_address(0), size(0), mapped(NULL), block(NULL), owner(NULL) {}
+		sub_allocation(VkDeviceMemory memory, uint32_t memory_type, VkDeviceAddress address, VkDeviceSize size, void* mapped, tlsf::block_handle block, device_block* owner) 
+				: memory_type_index(memory_type), handle(memory), start_address(address), size(size), mapped(mapped), block(block), owner(owner) {}
 		uint32_t memory_type_index;
 		VkDeviceMemory handle;
 		VkDeviceAddress start_address;
+		VkDeviceSize size;
+		// host visible memory stays mapped for its whole lifetime. NULL for device only memory.
+		// Writes through this pointer have to be followed by allocator::flush
+		void* mapped;
+		// used by the allocator to free in constant time
+		tlsf::block_handle block;
+		device_block* owner;
 		operator bool() const { return memory_type_index != 0xFFFFFFFF; };
 	};
 	static sub_allocation invalid_allocation;
 
 	// allocates memory from a large memory buffer
 	sub_allocation allocate(size_t size, uint32_t memory_type_bits, access_flags access_flags);
+	// places the allocation according to the alignment of the resource and the bufferImageGranularity
+	sub_allocation allocate(const VkMemoryRequirements& requirements, access_flags access_flags, tiling resource_tiling = tiling::LINEAR);
 
 	// deallocates memory 
 	void free(const sub_allocation& allocation);
@@ -42,42 +72,66 @@ public:
 
 	void initialize(VkPhysicalDevice physicalDevice, VkDevice device);
 
+	// called once per frame. Releases device memory blocks that have been empty for longer than the grace period
+	void release_unused_blocks();
+
+	// number of frames an empty block is kept alive before it is given back to the driver
+	void set_empty_block_grace_period(uint32_t frames) { m_empty_block_grace_period = frames; }
+
+	const statistics& get_statistics() const { return m_statistics; }
+
+	// makes host writes to the range visible to the device. Does nothing for host coherent memory.
+	// The range is only recorded here. All recorded ranges are flushed together by flush_mapped_ranges
+	void flush(const sub_allocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+	// issues a single vkFlushMappedMemoryRanges for all pending ranges. Called before every queue submission
+	bool flush_mapped_ranges();
+	// makes device writes to the range visible to the host. Does nothing for host coherent memory
+	bool invalidate(const sub_allocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+
 private:
 	VkDevice m_device;
-	VkDeviceSize m_default_allocation_size = 1 << 28;
+	// the first block of a memory type has the initial size. Every following block doubles in size up to the max size
+	VkDeviceSize m_initial_block_size = 1 << 26;
+	VkDeviceSize m_max_block_size = 1 << 28;
+	uint32_t m_empty_block_grace_period = 120;
+	uint64_t m_frame_index = 0;
+	VkDeviceSize m_buffer_image_granularity = 1;
+	VkDeviceSize m_non_coherent_atom_size = 1;
+	std::vector<VkMappedMemoryRange> m_pending_flushes;
+	statistics m_statistics{};
 	bool m_initialized;
 
-	struct memory_block {
-		VkDeviceAddress address;
+	// one VkDeviceMemory. Sub allocations are made from it
+	struct device_block {
+		VkDeviceMemory handle;
 		VkDeviceSize size;
+		tlsf blocks;
+		void* mapped; // mapped once on creation if the memory is host visible
 
-		inline VkDeviceAddress start() const { return address; }
-		inline VkDeviceAddress end() const { return address + size; }
+		uint64_t empty_since_frame;
 	};
 
+	// pool of device blocks of a single memory type
 	struct memory {
 		uint32_t memory_type_index;
 		VkMemoryType memory_type_info;
 		VkMemoryHeap heap_type_info;
 
-		VkDeviceMemory handle;
-		size_t size;
-
-		std::vector<memory_block> blocks;
+		std::vector<device_block*> device_blocks;
+		VkDeviceSize next_block_size;
 	};
 
-	sub_allocation sub_allocate(memory& memory, size_t size);
+	sub_allocation sub_allocate(memory& memory, VkDeviceSize size, VkDeviceSize alignment);
 	void free(memory& memory, const sub_allocation& allocation);
 	void free(memory& memory);
+	void free_device_block(memory& memory, size_t index);
 	memory* find_memory_type(uint32_t memory_type_bits, access_flags access_flags);
 	static bool matches_type(const memory& memory, uint32_t memory_type_bits, access_flags flags);
-	bool initial_allocation(memory& memory);
+	device_block* allocate_device_block(memory& memory, VkDeviceSize min_size);
 	
 	uint32_t m_memory_type_count;
 	std::array<memory, VK_MAX_MEMORY_TYPES> m_allocated_memory_types;
-	
 
-	bool find_space(memory_block* space, size_t* index, const memory& memory, size_t size);
 
 	void print_memory_leaks();
 
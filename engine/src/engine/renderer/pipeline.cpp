@@ -1,40 +1,37 @@
 #include "pipeline.h"
 #include "context.h"
+#include "shader.h"
 #include <stdlib.h>
 #include <assert.h>
 
 VkFormat pipeline_builder::convert_to_vk_format(data_type type, uint32_t count) {
-	if(count == 1) {
-		if(type == data_type::FLOAT)
-			return VK_FORMAT_R32_SFLOAT;
-		else if (type == data_type::INT)
-			return VK_FORMAT_R32_SINT;
-		else if (type == data_type::UINT)
-			return VK_FORMAT_R32_UINT;
-	}else if (count == 2) {
-		if (type == data_type::FLOAT)
-			return VK_FORMAT_R32G32_SFLOAT;
-		else if (type == data_type::INT)
-			return VK_FORMAT_R32G32_SINT;
-		else if (type == data_type::UINT)
-			return VK_FORMAT_R32G32_UINT;
-	}else if (count == 3) {
-		if (type == data_type::FLOAT)
-			return VK_FORMAT_R32G32B32_SFLOAT;
-		else if (type == data_type::INT)
-			return VK_FORMAT_R32G32B32_SINT;
-		else if (type == data_type::UINT)
-			return VK_FORMAT_R32G32B32_UINT;
-	}else if (count == 3) {
-		if (type == data_type::FLOAT)
-			return VK_FORMAT_R32G32B32A32_SFLOAT;
-		else if (type == data_type::INT)
-			return VK_FORMAT_R32G32B32A32_SINT;
-		else if (type == data_type::UINT)
-			return VK_FORMAT_R32G32B32A32_UINT;
+	assert(count >= 1 && count <= 4);
+	// indexed by the component count - 1
+	static const VkFormat formats[][4] = {
+		{ VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT },
+		{ VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT },
+		{ VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT },
+		{ VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_R8G8B8A8_UNORM },
+		{ VK_FORMAT_R8_SNORM, VK_FORMAT_R8G8_SNORM, VK_FORMAT_R8G8B8_SNORM, VK_FORMAT_R8G8B8A8_SNORM },
+		{ VK_FORMAT_R16_UNORM, VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16B16_UNORM, VK_FORMAT_R16G16B16A16_UNORM },
+		{ VK_FORMAT_R16_SNORM, VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16B16_SNORM, VK_FORMAT_R16G16B16A16_SNORM },
+	};
+	if (count < 1 || count > 4)
+		return VK_FORMAT_UNDEFINED;
+	return formats[(uint32_t)type][count - 1];
+}
+
+uint32_t pipeline_builder::size_of(data_type type) {
+	switch (type) {
+	case data_type::UNORM8:
+	case data_type::SNORM8:
+		return 1;
+	case data_type::UNORM16:
+	case data_type::SNORM16:
+		return 2;
+	default:
+		return 4;
 	}
-	assert(false);
-	return VK_FORMAT_R32G32B32A32_UINT;
 }
 
 
@@ -65,20 +62,222 @@ void pipeline_builder::set_geometry_shader(VkShaderModule geometry_module) {
 	init_shader_stage_create_info(info, VK_SHADER_STAGE_GEOMETRY_BIT, geometry_module);
 }
 
+template<typename T>
+static void append(std::string& key, const T& value) {
+	key.append((const char*)&value, sizeof(T));
+}
+
+// modules with the same code share an entry. Modules that were not created by the shader class have no known code,
+// and their handle may be reused for different code later, so pipelines with them can't be shared
+static bool append_shader_module(std::string& key, VkShaderModule shader_module) {
+	uint64_t hash = shader::get_code_hash(shader_module);
+	if (hash == 0)
+		return false;
+	append(key, hash);
+	return true;
+}
+
+VkPipeline pipeline_registry::find_pipeline(const std::string& key) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_pipelines.find(key);
+	return it != m_pipelines.end() ? it->second : VK_NULL_HANDLE;
+}
+
+VkPipelineLayout pipeline_registry::find_layout(const std::string& key) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_layouts.find(key);
+	return it != m_layouts.end() ? it->second : VK_NULL_HANDLE;
+}
+
+VkPipeline pipeline_registry::add_pipeline(const std::string& key, VkPipeline pipeline) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto [it, inserted] = m_pipelines.try_emplace(key, pipeline);
+	if (!inserted)
+		vkDestroyPipeline(context::get_device(), pipeline, NULL);
+	return it->second;
+}
+
+void pipeline_registry::add_unshared_pipeline(VkPipeline pipeline) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_unshared_pipelines.push_back(pipeline);
+}
+
+VkPipelineLayout pipeline_registry::add_layout(const std::string& key, VkPipelineLayout layout) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto [it, inserted] = m_layouts.try_emplace(key, layout);
+	if (!inserted)
+		vkDestroyPipelineLayout(context::get_device(), layout, NULL);
+	return it->second;
+}
+
+size_t pipeline_registry::pipeline_count() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_pipelines.size() + m_unshared_pipelines.size();
+}
+
+size_t pipeline_registry::layout_count() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_layouts.size();
+}
+
+void pipeline_registry::destroy(VkDevice device) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto& [key, pipeline] : m_pipelines)
+		vkDestroyPipeline(device, pipeline, NULL);
+	for (VkPipeline pipeline : m_unshared_pipelines)
+		vkDestroyPipeline(device, pipeline, NULL);
+	for (auto& [key, layout] : m_layouts)
+		vkDestroyPipelineLayout(device, layout, NULL);
+	m_pipelines.clear();
+	m_unshared_pipelines.clear();
+	m_layouts.clear();
+}
+
+// graphics and compute pipelines share layouts with the same set layouts and push constant ranges
+static std::string pipeline_layout_key(const std::vector<VkDescriptorSetLayout>& set_layouts, const std::vector<VkPushConstantRange>& push_constant_ranges) {
+	std::string key;
+	append(key, (uint32_t)set_layouts.size());
+	for (VkDescriptorSetLayout set_layout : set_layouts)
+		append(key, set_layout);
+	for (const VkPushConstantRange& range : push_constant_ranges) {
+		append(key, range.stageFlags);
+		append(key, range.offset);
+		append(key, range.size);
+	}
+	return key;
+}
+
+static VkResult create_pipeline_layout(const std::vector<VkDescriptorSetLayout>& set_layouts, const std::vector<VkPushConstantRange>& push_constant_ranges, VkPipelineLayout* layout) {
+	VkPipelineLayoutCreateInfo layout_create_info = { };
+	layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_create_info.pNext = NULL;
+	layout_create_info.flags = 0;
+	layout_create_info.setLayoutCount = (uint32_t)set_layouts.size();
+	layout_create_info.pSetLayouts = set_layouts.data();
+	layout_create_info.pushConstantRangeCount = (uint32_t)push_constant_ranges.size();
+	layout_create_info.pPushConstantRanges = push_constant_ranges.data();
+	return vkCreatePipelineLayout(context::get_device(), &layout_create_info, NULL, layout);
+}
+
+// looks up the layout in the registry and creates it if there is none
+static VkPipelineLayout find_or_create_layout(const std::string& key, const std::vector<VkDescriptorSetLayout>& set_layouts, const std::vector<VkPushConstantRange>& push_constant_ranges) {
+	pipeline_registry& registry = context::get_pipeline_registry();
+	VkPipelineLayout layout = registry.find_layout(key);
+	if (layout != VK_NULL_HANDLE)
+		return layout;
+	if (create_pipeline_layout(set_layouts, push_constant_ranges, &layout) != VK_SUCCESS)
+		return VK_NULL_HANDLE;
+	return registry.add_layout(key, layout);
+}
+
+std::string pipeline_builder::layout_key() const {
+	return pipeline_layout_key(m_set_layouts, m_push_constant_ranges);
+}
+
+// the viewport is left out because it is dynamic state. Empty if a shader module has no known code
+std::string pipeline_builder::pipeline_key(const std::string& layout_key) const {
+	std::string key;
+	append(key, VK_PIPELINE_BIND_POINT_GRAPHICS);
+	append(key, (uint32_t)m_shader_stages.size());
+	for (const VkPipelineShaderStageCreateInfo& stage : m_shader_stages) {
+		append(key, stage.stage);
+		if (!append_shader_module(key, stage.module))
+			return std::string();
+		key.append(stage.pName);
+		key.push_back('\0');
+	}
+	append(key, (uint32_t)m_buffer_layout.size());
+	for (const buffer_layout_element& e : m_buffer_layout) {
+		append(key, e.binding);
+		append(key, e.offset);
+		append(key, e.type);
+		append(key, e.count);
+	}
+	append(key, (uint32_t)m_buffer_layout_bindings.size());
+	for (const buffer_layout_binding& b : m_buffer_layout_bindings) {
+		append(key, b.stride);
+		append(key, b.input_rate);
+	}
+	append(key, m_culling_enabled);
+	append(key, m_depth_test);
+	append(key, m_depth_write);
+	append(key, m_depth_compare_op);
+	append(key, m_depth_only);
+	append(key, m_stencil_test);
+	append(key, m_blending);
+	append(key, m_samples);
+	// pipelines for dynamic rendering only depend on the formats
+	append(key, m_render_pass);
+	append(key, m_subpass);
+	append(key, (uint32_t)m_color_formats.size());
+	for (VkFormat format : m_color_formats)
+		append(key, format);
+	append(key, m_depth_format);
+	append(key, (uint32_t)layout_key.size());
+	key.append(layout_key);
+	return key;
+}
+
 void pipeline_builder::build(VkPipeline* pipeline, VkPipelineLayout* layout) {
+	pipeline_registry& registry = context::get_pipeline_registry();
+
+	std::string layout_state = layout_key();
+	*layout = find_or_create_layout(layout_state, m_set_layouts, m_push_constant_ranges);
+	if (*layout == VK_NULL_HANDLE) {
+		*pipeline = VK_NULL_HANDLE;
+		return;
+	}
+
+	std::string pipeline_state = pipeline_key(layout_state);
+	if (!pipeline_state.empty()) {
+		*pipeline = registry.find_pipeline(pipeline_state);
+		if (*pipeline != VK_NULL_HANDLE)
+			return;
+	}
+	if (create_pipeline(*layout, pipeline) != VK_SUCCESS) {
+		*pipeline = VK_NULL_HANDLE;
+		return;
+	}
+	if (pipeline_state.empty())
+		registry.add_unshared_pipeline(*pipeline);
+	else
+		*pipeline = registry.add_pipeline(pipeline_state, *pipeline);
+}
+
+std::future<pipeline_builder::build_result> pipeline_builder::build_async(thread_pool& pool) const {
+	// vkCreateGraphicsPipelines and the pipeline cache can be used from several threads at once
+	return pool.submit([builder = *this]() mutable {
+		build_result result;
+		builder.build(&result.pipeline, &result.layout);
+		return result;
+	});
+}
+
+std::vector<std::future<pipeline_builder::build_result>> pipeline_builder::build_async(thread_pool& pool, const std::vector<pipeline_builder>& builders) {
+	std::vector<std::future<build_result>> results;
+	results.reserve(builders.size());
+	for (const pipeline_builder& builder : builders)
+		results.push_back(builder.build_async(pool));
+	return results;
+}
+
+VkResult pipeline_builder::create_pipeline(VkPipelineLayout layout, VkPipeline* pipeline) {
 
 	VkResult result;
 	VkGraphicsPipelineCreateInfo create_info = { };
+	VkPipelineCreationFeedback feedback = { };
+	VkPipelineCreationFeedbackCreateInfo feedback_create_info = { };
 
-	char* vertex_buffer_description = (char*)malloc(m_buffer_layout.size() * (sizeof(VkVertexInputBindingDescription) + sizeof(VkVertexInputAttributeDescription)));
+	size_t binding_count = m_buffer_layout_bindings.size();
+	char* vertex_buffer_description = (char*)malloc(binding_count * sizeof(VkVertexInputBindingDescription) + m_buffer_layout.size() * sizeof(VkVertexInputAttributeDescription));
 	VkVertexInputBindingDescription* bindings = (VkVertexInputBindingDescription*)vertex_buffer_description;
-	VkVertexInputAttributeDescription* attributes = (VkVertexInputAttributeDescription*)(vertex_buffer_description + m_buffer_layout.size() * sizeof(VkVertexInputBindingDescription));
+	VkVertexInputAttributeDescription* attributes = (VkVertexInputAttributeDescription*)(vertex_buffer_description + binding_count * sizeof(VkVertexInputBindingDescription));
 	
 	VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = { };
 	vertex_input_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vertex_input_state_create_info.flags = 0;
 	vertex_input_state_create_info.vertexAttributeDescriptionCount = (uint32_t)m_buffer_layout.size();
-	vertex_input_state_create_info.vertexBindingDescriptionCount = (uint32_t)m_buffer_layout.size();
+	vertex_input_state_create_info.vertexBindingDescriptionCount = (uint32_t)binding_count;
 	vertex_input_state_create_info.pVertexAttributeDescriptions = attributes;
 	vertex_input_state_create_info.pVertexBindingDescriptions = bindings;
 	init_vertex_input_state_create_info(bindings, attributes);
@@ -138,8 +337,8 @@ void pipeline_builder::build(VkPipeline* pipeline, VkPipelineLayout* layout) {
 	depth_stencil_create_info.pNext = NULL;
 	depth_stencil_create_info.flags = 0;
 	depth_stencil_create_info.depthTestEnable = m_depth_test;
-	depth_stencil_create_info.depthWriteEnable = m_depth_test;
-	depth_stencil_create_info.depthCompareOp = VK_COMPARE_OP_LESS;
+	depth_stencil_create_info.depthWriteEnable = m_depth_test && m_depth_write;
+	depth_stencil_create_info.depthCompareOp = m_depth_compare_op;
 	depth_stencil_create_info.depthBoundsTestEnable = VK_FALSE;
 	depth_stencil_create_info.minDepthBounds = VK_FALSE;
 	depth_stencil_create_info.maxDepthBounds = VK_FALSE;
@@ -162,8 +361,16 @@ void pipeline_builder::build(VkPipeline* pipeline, VkPipelineLayout* layout) {
 	color_blend_state.flags = 0;
 	color_blend_state.logicOpEnable = VK_FALSE;
 	color_blend_state.logicOp = VK_LOGIC_OP_SET; // Dont't care only for integer framebuffer attachments
-	color_blend_state.attachmentCount = 1;
-	color_blend_state.pAttachments = &attachment_blending;
+	// every color attachment is blended the same way
+	constexpr uint32_t max_color_attachments = 8;
+	assert(m_color_formats.size() <= max_color_attachments);
+	VkPipelineColorBlendAttachmentState attachment_blendings[max_color_attachments];
+	for (uint32_t i = 0; i < max_color_attachments; i++)
+		attachment_blendings[i] = attachment_blending;
+	color_blend_state.attachmentCount = m_render_pass != VK_NULL_HANDLE ? 1 : (uint32_t)m_color_formats.size();
+	if (m_depth_only)
+		color_blend_state.attachmentCount = 0;
+	color_blend_state.pAttachments = attachment_blendings;
 	for(int i = 0; i < 4; i++)
 		color_blend_state.blendConstants[i] = 0.0f;
 
@@ -177,13 +384,6 @@ void pipeline_builder::build(VkPipeline* pipeline, VkPipelineLayout* layout) {
 	dynamic_state.dynamicStateCount = (uint32_t)sizeof(states) / sizeof(states[0]);
 
 
-	
-	VkResult layout_result = create_pipeline_layout(layout);
-	if(layout_result != VK_SUCCESS) {
-		result = layout_result;
-		goto return_label;
-	}
-
 
 
 
@@ -194,6 +394,7 @@ void pipeline_builder::build(VkPipeline* pipeline, VkPipelineLayout* layout) {
 	create_info.stageCount = (uint32_t)m_shader_stages.size();
 	create_info.pStages = m_shader_stages.data();
 	create_info.renderPass = m_render_pass;
+	create_info.subpass = m_subpass;
 	create_info.pVertexInputState = &vertex_input_state_create_info;
 	create_info.pInputAssemblyState = &input_assembly_state_create_info;
 	create_info.pTessellationState = NULL; // VUID-VkGraphicsPipelineCreateInfo-pStages-00731 implies that this can be NULL if you don't use a tesselation shader
@@ -203,25 +404,48 @@ void pipeline_builder::build(VkPipeline* pipeline, VkPipelineLayout* layout) {
 	create_info.pDepthStencilState = &depth_stencil_create_info;
 	create_info.pColorBlendState = &color_blend_state;
 	create_info.pDynamicState = &dynamic_state;
-	create_info.layout = *layout;
+	create_info.layout = layout;
 
 	// do not derive for now
 	create_info.basePipelineIndex = -1;
 	create_info.basePipelineHandle = VK_NULL_HANDLE;
+
+	// the driver reports whether the pipeline came from the cache
+	feedback_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+	feedback_create_info.pNext = NULL;
+	feedback_create_info.pPipelineCreationFeedback = &feedback;
+	feedback_create_info.pipelineStageCreationFeedbackCount = 0;
+	feedback_create_info.pPipelineStageCreationFeedbacks = NULL;
+	create_info.pNext = &feedback_create_info;
+
+	// without a render pass the attachment formats come from here
+	VkPipelineRenderingCreateInfo rendering_create_info = {};
+	rendering_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	rendering_create_info.pNext = NULL;
+	rendering_create_info.viewMask = 0;
+	rendering_create_info.colorAttachmentCount = m_depth_only ? 0 : (uint32_t)m_color_formats.size();
+	rendering_create_info.pColorAttachmentFormats = m_color_formats.data();
+	rendering_create_info.depthAttachmentFormat = m_depth_format;
+	rendering_create_info.stencilAttachmentFormat = has_stencil_component(m_depth_format) ? m_depth_format : VK_FORMAT_UNDEFINED;
+	if (m_render_pass == VK_NULL_HANDLE)
+		feedback_create_info.pNext = &rendering_create_info;
 	
-	result = vkCreateGraphicsPipelines(context::get_device(), VK_NULL_HANDLE, 1, &create_info, NULL, pipeline);
-return_label:
+	result = vkCreateGraphicsPipelines(context::get_device(), context::get_pipeline_cache().get_handle(), 1, &create_info, NULL, pipeline);
+	if (result == VK_SUCCESS)
+		context::get_pipeline_cache().record(feedback);
 	free(vertex_buffer_description);
+	return result;
 }
 
 void pipeline_builder::init_vertex_input_state_create_info(VkVertexInputBindingDescription* bindings, VkVertexInputAttributeDescription* attributes) {
+	for (uint32_t i = 0; i < m_buffer_layout_bindings.size(); i++) {
+		bindings[i].binding = i;
+		bindings[i].inputRate = m_buffer_layout_bindings[i].input_rate;
+		bindings[i].stride = m_buffer_layout_bindings[i].stride;
+	}
 	for (uint32_t i = 0; i < m_buffer_layout.size(); i++) {
 		buffer_layout_element& e = m_buffer_layout[i];
-		bindings[i].binding = i;
-		bindings[i].inputRate = e.input_rate;
-		bindings[i].stride = m_buffer_layout_stride;
-
-		attributes[i].binding = i;
+		attributes[i].binding = e.binding;
 		attributes[i].format = convert_to_vk_format(e.type, e.count);
 		attributes[i].location = i;
 		attributes[i].offset = e.offset;
@@ -229,14 +453,29 @@ void pipeline_builder::init_vertex_input_state_create_info(VkVertexInputBindingD
 
 }
 
-void pipeline_builder::buffer_layout_push_floats(uint32_t count) {
-	uint32_t offset_to_old_end = m_buffer_layout_stride;
+uint32_t pipeline_builder::buffer_layout_add_binding(VkVertexInputRate input_rate) {
+	buffer_layout_binding& b = m_buffer_layout_bindings.emplace_back();
+	b.stride = 0;
+	b.input_rate = input_rate;
+	return (uint32_t)m_buffer_layout_bindings.size() - 1;
+}
+
+void pipeline_builder::buffer_layout_push(data_type type, uint32_t count) {
+	if (m_buffer_layout_bindings.empty())
+		buffer_layout_add_binding(VK_VERTEX_INPUT_RATE_VERTEX);
+	buffer_layout_binding& b = m_buffer_layout_bindings.back();
+
 	buffer_layout_element& e = m_buffer_layout.emplace_back();
+	e.binding = (uint32_t)m_buffer_layout_bindings.size() - 1;
 	e.count = count;
-	e.input_rate = VK_VERTEX_INPUT_RATE_VERTEX;
-	e.type = data_type::FLOAT;
-	e.offset = offset_to_old_end;
-	m_buffer_layout_stride += sizeof(float) * count;
+	e.type = type;
+	e.offset = b.stride;
+	b.stride += size_of(type) * count;
+}
+
+void pipeline_builder::buffer_layout_push_mat4() {
+	for (uint32_t column = 0; column < 4; column++)
+		buffer_layout_push(data_type::FLOAT, 4);
 }
 
 void pipeline_builder::set_viewport(float x, float y, float width, float height, float min_depth, float max_depth) {
@@ -248,28 +487,82 @@ void pipeline_builder::set_viewport(float x, float y, float width, float height,
 	m_viewport.maxDepth = max_depth;
 }
 
-VkResult pipeline_builder::create_pipeline_layout(VkPipelineLayout* layout) {
-	
+void pipeline_builder::push_constant(VkShaderStageFlags shader_stage, size_t offset, size_t size) {
+	VkPushConstantRange& range = m_push_constant_ranges.emplace_back();
+	range.stageFlags = shader_stage;
+	range.offset = (uint32_t) offset;
+	range.size = (uint32_t)size;
+}
 
-	
+void compute_pipeline_builder::set_shader(VkShaderModule compute_module) {
+	init_shader_stage_create_info(m_shader_stage, VK_SHADER_STAGE_COMPUTE_BIT, compute_module);
+}
 
-	VkPipelineLayoutCreateInfo layout_create_info = { };
-	layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	layout_create_info.pNext = NULL;
-	layout_create_info.flags = 0;
-	layout_create_info.setLayoutCount = 0;
-	layout_create_info.pSetLayouts = NULL;
-	layout_create_info.pushConstantRangeCount = (uint32_t)m_push_constant_ranges.size();
-	layout_create_info.pPushConstantRanges = m_push_constant_ranges.data();
+void compute_pipeline_builder::push_constant(size_t offset, size_t size) {
+	VkPushConstantRange& range = m_push_constant_ranges.emplace_back();
+	range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	range.offset = (uint32_t)offset;
+	range.size = (uint32_t)size;
+}
 
-	
-	return vkCreatePipelineLayout(context::get_device(), &layout_create_info, NULL, layout);
+// empty if the shader module has no known code
+std::string compute_pipeline_builder::pipeline_key(const std::string& layout_key) const {
+	std::string key;
+	append(key, VK_PIPELINE_BIND_POINT_COMPUTE);
+	if (!append_shader_module(key, m_shader_stage.module))
+		return std::string();
+	key.append(m_shader_stage.pName);
+	key.push_back('\0');
+	append(key, (uint32_t)layout_key.size());
+	key.append(layout_key);
+	return key;
 }
 
+VkResult compute_pipeline_builder::create_pipeline(VkPipelineLayout layout, VkPipeline* pipeline) {
+	VkPipelineCreationFeedback feedback = {};
+	VkPipelineCreationFeedbackCreateInfo feedback_create_info = {};
+	feedback_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+	feedback_create_info.pNext = NULL;
+	feedback_create_info.pPipelineCreationFeedback = &feedback;
+	feedback_create_info.pipelineStageCreationFeedbackCount = 0;
+	feedback_create_info.pPipelineStageCreationFeedbacks = NULL;
+
+	VkComputePipelineCreateInfo create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	create_info.pNext = &feedback_create_info;
+	create_info.flags = 0;
+	create_info.stage = m_shader_stage;
+	create_info.layout = layout;
+	create_info.basePipelineHandle = VK_NULL_HANDLE;
+	create_info.basePipelineIndex = -1;
 
-void pipeline_builder::push_constant(VkShaderStageFlags shader_stage, size_t offset, size_t size) {
-	VkPushConstantRange& range = m_push_constant_ranges.emplace_back();
-	range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	range.offset = (uint32_t) offset;
-	range.size = (uint32_t)size;
-}
\ No newline at end of file
+	VkResult result = vkCreateComputePipelines(context::get_device(), context::get_pipeline_cache().get_handle(), 1, &create_info, NULL, pipeline);
+	if (result == VK_SUCCESS)
+		context::get_pipeline_cache().record(feedback);
+	return result;
+}
+
+void compute_pipeline_builder::build(VkPipeline* pipeline, VkPipelineLayout* layout) {
+	std::string layout_state = pipeline_layout_key(m_set_layouts, m_push_constant_ranges);
+	*layout = find_or_create_layout(layout_state, m_set_layouts, m_push_constant_ranges);
+	if (*layout == VK_NULL_HANDLE) {
+		*pipeline = VK_NULL_HANDLE;
+		return;
+	}
+
+	pipeline_registry& registry = context::get_pipeline_registry();
+	std::string pipeline_state = pipeline_key(layout_state);
+	if (!pipeline_state.empty()) {
+		*pipeline = registry.find_pipeline(pipeline_state);
+		if (*pipeline != VK_NULL_HANDLE)
+			return;
+	}
+	if (create_pipeline(*layout, pipeline) != VK_SUCCESS) {
+		*pipeline = VK_NULL_HANDLE;
+		return;
+	}
+	if (pipeline_state.empty())
+		registry.add_unshared_pipeline(*pipeline);
+	else
+		*pipeline = registry.add_pipeline(pipeline_state, *pipeline);
+}
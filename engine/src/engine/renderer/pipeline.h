@@ -4,16 +4,84 @@
 
 #include <vulkan/vulkan.h>
 #include <vector>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <future>
+#include "engine/core/thread_pool.h"
+
+/*
+* Owns all pipelines and pipeline layouts created by pipeline_builder.
+* They are looked up by a key that contains the complete builder state, so an identical
+* builder returns the existing objects instead of creating new ones.
+* The registry can be used from several threads.
+*/
+class pipeline_registry {
+public:
+	VkPipeline find_pipeline(const std::string& key) const;
+	VkPipelineLayout find_layout(const std::string& key) const;
+	// another thread may have added the same key in the meantime. The object that is in the registry
+	// is returned and the passed one is destroyed if it lost
+	VkPipeline add_pipeline(const std::string& key, VkPipeline pipeline);
+	VkPipelineLayout add_layout(const std::string& key, VkPipelineLayout layout);
+	// pipelines whose shader code is unknown are owned by the registry but never returned by a lookup
+	void add_unshared_pipeline(VkPipeline pipeline);
+
+	size_t pipeline_count() const;
+	size_t layout_count() const;
+
+	// destroys all pipelines and layouts
+	void destroy(VkDevice device);
+private:
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, VkPipeline> m_pipelines;
+	std::vector<VkPipeline> m_unshared_pipelines;
+	std::unordered_map<std::string, VkPipelineLayout> m_layouts;
+};
 
 class pipeline_builder {
 public:
 	pipeline_builder(VkRenderPass render_pass) 
-		: m_render_pass(render_pass), m_buffer_layout_stride(0), m_culling_enabled(VK_FALSE), m_depth_test(VK_FALSE), m_stencil_test(VK_FALSE), m_blending(VK_FALSE), m_samples(1) {
+		: m_render_pass(render_pass), m_culling_enabled(VK_FALSE), m_depth_test(VK_FALSE), m_stencil_test(VK_FALSE), m_blending(VK_FALSE), m_samples(1) {
+	}
+	// for dynamic rendering. The pipeline can be used with any attachments of these formats, so pipelines are
+	// shared by all passes that render to the same formats. depth_format may be VK_FORMAT_UNDEFINED
+	pipeline_builder(const std::vector<VkFormat>& color_formats, VkFormat depth_format = VK_FORMAT_UNDEFINED)
+		: m_render_pass(VK_NULL_HANDLE), m_color_formats(color_formats), m_depth_format(depth_format),
+		m_culling_enabled(VK_FALSE), m_depth_test(VK_FALSE), m_stencil_test(VK_FALSE), m_blending(VK_FALSE), m_samples(1) {
 	}
 
+	// returns the pipeline and layout of an identical earlier build if there is one. Only pipelines whose shader
+	// modules were loaded by the shader class are shared.
+	// Both are owned by the pipeline registry of the context and must not be destroyed by the caller
 	void build(VkPipeline* pipeline, VkPipelineLayout* layout);
 
-	void buffer_layout_push_floats(uint32_t count);
+	struct build_result {
+		VkPipeline pipeline;
+		VkPipelineLayout layout;
+	};
+	// builds a copy of the builder on the pool. The shader modules have to stay alive until the future is ready
+	std::future<build_result> build_async(thread_pool& pool) const;
+	// compiles all builders in parallel. The futures are in the order of the builders
+	static std::vector<std::future<build_result>> build_async(thread_pool& pool, const std::vector<pipeline_builder>& builders);
+
+	enum class data_type {
+		FLOAT, INT, UINT,
+		// read as floats in [0, 1] or [-1, 1]
+		UNORM8, SNORM8, UNORM16, SNORM16
+	};
+
+	// starts a new vertex buffer binding. The following attributes are read from it.
+	// Per instance bindings advance once per instance instead of once per vertex. Returns the binding index
+	uint32_t buffer_layout_add_binding(VkVertexInputRate input_rate = VK_VERTEX_INPUT_RATE_VERTEX);
+	// appends an attribute with count components to the current binding. Every attribute gets the next location.
+	// Without a binding a per vertex binding is started
+	void buffer_layout_push(data_type type, uint32_t count);
+	void buffer_layout_push_floats(uint32_t count) { buffer_layout_push(data_type::FLOAT, count); }
+	void buffer_layout_push_ints(uint32_t count) { buffer_layout_push(data_type::INT, count); }
+	void buffer_layout_push_uints(uint32_t count) { buffer_layout_push(data_type::UINT, count); }
+	// a mat4 takes four locations, one for each column
+	void buffer_layout_push_mat4();
 
 	void set_viewport(float x, float y, float width, float height, float min_depth = 0.0f, float max_depth = 1.0f);
 
@@ -23,11 +91,21 @@ public:
 
 	void set_culling(bool enabled) { m_culling_enabled = enabled; }
 	void set_depth_test(bool enabled) { m_depth_test = enabled; }
+	// depth writes only happen with the depth test enabled
+	void set_depth_write(bool enabled) { m_depth_write = enabled; }
+	void set_depth_compare_op(VkCompareOp compare_op) { m_depth_compare_op = compare_op; }
+	// a pipeline without color outputs for depth pre-passes. It only needs a vertex shader that writes the position.
+	// The shading afterwards uses VK_COMPARE_OP_EQUAL with depth writes off, so only visible fragments are shaded
+	void set_depth_only(bool enabled) { m_depth_only = enabled; }
 	void set_stencil_test(bool enabled) { m_stencil_test = enabled; }
 	void set_blending(bool enabled) { m_blending = enabled; }
 
 	void set_sample_count(int samples) { m_samples = samples; }
+	// the subpass of the render pass the pipeline is used in
+	void set_subpass(uint32_t subpass) { m_subpass = subpass; }
 
+	// sets are numbered in the order the layouts are added. Layouts come from the descriptor_layout_cache of the context
+	void add_descriptor_set_layout(VkDescriptorSetLayout set_layout) { m_set_layouts.push_back(set_layout); }
 	
 	template<typename T>
 	void push_constant(VkShaderStageFlags shader_stage, size_t offset) {
@@ -41,37 +119,82 @@ private:
 	std::vector<VkPipelineShaderStageCreateInfo> m_shader_stages;
 
 	VkRenderPass m_render_pass;
+	// attachment formats if there is no render pass
+	std::vector<VkFormat> m_color_formats;
+	VkFormat m_depth_format = VK_FORMAT_UNDEFINED;
 	VkViewport m_viewport;
 	int m_samples;
+	uint32_t m_subpass = 0;
 	
 
-	enum class data_type {
-		FLOAT, INT, UINT
-	};
-
 	struct buffer_layout_element {
+		uint32_t binding;
 		uint32_t offset;
 		data_type type;
 		uint32_t count;
+	};
+
+	struct buffer_layout_binding {
+		uint32_t stride;
 		VkVertexInputRate input_rate;
 	};
 
 	VkBool32 m_culling_enabled;
 	VkBool32 m_depth_test;
+	VkBool32 m_depth_write = VK_TRUE;
+	VkCompareOp m_depth_compare_op = VK_COMPARE_OP_LESS;
+	VkBool32 m_depth_only = VK_FALSE;
 	VkBool32 m_stencil_test;
 	VkBool32 m_blending;
 	
 	void init_vertex_input_state_create_info(VkVertexInputBindingDescription* bindings, VkVertexInputAttributeDescription* attributes);
 	std::vector<buffer_layout_element> m_buffer_layout;
-	uint32_t m_buffer_layout_stride;
+	std::vector<buffer_layout_binding> m_buffer_layout_bindings;
 	static VkFormat convert_to_vk_format(data_type type, uint32_t count);
-	VkResult create_pipeline_layout(VkPipelineLayout* layout);
+	static uint32_t size_of(data_type type);
+	VkResult create_pipeline(VkPipelineLayout layout, VkPipeline* pipeline);
 
+	// the state that defines the pipeline layout and the pipeline as a byte string
+	std::string layout_key() const;
+	std::string pipeline_key(const std::string& layout_key) const;
 
 
+
+	std::vector<VkDescriptorSetLayout> m_set_layouts;
 	std::vector<VkPushConstantRange> m_push_constant_ranges;
 
 };
 
+/*
+* Builds compute pipelines. Like pipeline_builder it shares identical pipelines and layouts through the registry
+* of the context. Dispatches are recorded into the graphics command buffers, the graphics queue can always run compute work.
+*/
+class compute_pipeline_builder {
+public:
+	void set_shader(VkShaderModule compute_module);
+	// sets are numbered in the order the layouts are added
+	void add_descriptor_set_layout(VkDescriptorSetLayout set_layout) { m_set_layouts.push_back(set_layout); }
+
+	template<typename T>
+	void push_constant(size_t offset) {
+		push_constant(offset, sizeof(T));
+	}
+	void push_constant(size_t offset, size_t size);
+
+	// the pipeline and layout are owned by the pipeline registry
+	void build(VkPipeline* pipeline, VkPipelineLayout* layout);
+
+	// number of work groups that cover count invocations
+	static uint32_t group_count(uint32_t count, uint32_t group_size) { return (count + group_size - 1) / group_size; }
+
+private:
+	VkResult create_pipeline(VkPipelineLayout layout, VkPipeline* pipeline);
+	std::string pipeline_key(const std::string& layout_key) const;
+
+	VkPipelineShaderStageCreateInfo m_shader_stage{};
+	std::vector<VkDescriptorSetLayout> m_set_layouts;
+	std::vector<VkPushConstantRange> m_push_constant_ranges;
+};
+
 
 #endif //ENGINE_RENDERER_PIPELINE_H
\ No newline at end of file
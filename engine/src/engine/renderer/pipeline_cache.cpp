@@ -0,0 +1,124 @@
+#include "pipeline_cache.h"
+#include "engine/core/log.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <filesystem>
+
+// layout of VkPipelineCacheHeaderVersionOne at the start of the cache data
+static constexpr size_t HEADER_SIZE = 16 + VK_UUID_SIZE;
+
+static bool read_file(const char* path, std::vector<char>& data) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+	fseek(file, 0L, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	if (size <= 0) {
+		fclose(file);
+		return false;
+	}
+	data.resize((size_t)size);
+	size_t n_bytes = fread(data.data(), 1, data.size(), file);
+	fclose(file);
+	return n_bytes == data.size();
+}
+
+bool pipeline_cache::initialize(VkPhysicalDevice physical_device, VkDevice device, const char* path) {
+	m_device = device;
+	m_path = path;
+	m_statistics = {};
+	vkGetPhysicalDeviceProperties(physical_device, &m_properties);
+
+	std::vector<char> data;
+	if (read_file(path, data) && !is_compatible(data.data(), data.size())) {
+		log("Ignoring pipeline cache %s. It was created for another device or driver\n", path);
+		data.clear();
+	}
+
+	VkPipelineCacheCreateInfo create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.initialDataSize = data.size();
+	create_info.pInitialData = data.empty() ? NULL : data.data();
+	if (vkCreatePipelineCache(m_device, &create_info, NULL, &m_handle) == VK_SUCCESS)
+		return true;
+
+	// the driver may still reject the data. Start with an empty cache in that case
+	create_info.initialDataSize = 0;
+	create_info.pInitialData = NULL;
+	return vkCreatePipelineCache(m_device, &create_info, NULL, &m_handle) == VK_SUCCESS;
+}
+
+void pipeline_cache::destroy() {
+	if (m_handle == VK_NULL_HANDLE)
+		return;
+	if (!save())
+		err("Failed to save the pipeline cache to %s\n", m_path.c_str());
+	log("pipeline cache: %u hits, %u misses, %u unknown, %.2f ms creating pipelines\n",
+		m_statistics.hits, m_statistics.misses, m_statistics.unknown, 1e-6 * m_statistics.creation_time_ns);
+
+	vkDestroyPipelineCache(m_device, m_handle, NULL);
+	m_handle = VK_NULL_HANDLE;
+}
+
+bool pipeline_cache::is_compatible(const void* data, size_t size) const {
+	if (size < HEADER_SIZE)
+		return false;
+	uint32_t header[4]; // header size, header version, vendor id, device id
+	memcpy(header, data, sizeof(header));
+	const uint8_t* uuid = (const uint8_t*)data + sizeof(header);
+
+	return header[0] >= HEADER_SIZE && header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header[2] == m_properties.vendorID && header[3] == m_properties.deviceID
+		&& memcmp(uuid, m_properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+bool pipeline_cache::save() const {
+	size_t size = 0;
+	if (vkGetPipelineCacheData(m_device, m_handle, &size, NULL) != VK_SUCCESS || size == 0)
+		return false;
+	std::vector<char> data(size);
+	if (vkGetPipelineCacheData(m_device, m_handle, &size, data.data()) != VK_SUCCESS)
+		return false;
+
+	std::string temp_path = m_path + ".tmp";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	bool written = fwrite(data.data(), 1, size, file) == size;
+	written &= fclose(file) == 0;
+	if (!written) {
+		remove(temp_path.c_str());
+		return false;
+	}
+
+	// replaces the old cache in one step
+	std::error_code error;
+	std::filesystem::rename(temp_path, m_path, error);
+	return !error;
+}
+
+bool pipeline_cache::merge(VkPipelineCache source) {
+	return vkMergePipelineCaches(m_device, m_handle, 1, &source) == VK_SUCCESS;
+}
+
+pipeline_cache::statistics pipeline_cache::get_statistics() const {
+	std::lock_guard<std::mutex> lock(m_statistics_mutex);
+	return m_statistics;
+}
+
+void pipeline_cache::record(const VkPipelineCreationFeedback& feedback) {
+	std::lock_guard<std::mutex> lock(m_statistics_mutex);
+	if (!(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT)) {
+		m_statistics.unknown++;
+		return;
+	}
+	if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT)
+		m_statistics.hits++;
+	else
+		m_statistics.misses++;
+	m_statistics.creation_time_ns += feedback.duration;
+}
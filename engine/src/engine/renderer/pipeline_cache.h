@@ -0,0 +1,49 @@
+#ifndef ENGINE_RENDERER_PIPELINE_CACHE_H
+#define ENGINE_RENDERER_PIPELINE_CACHE_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <string>
+#include <mutex>
+
+/*
+* VkPipelineCache that is stored on disk between runs.
+* The file is only used if it was written by the same driver for the same device,
+* otherwise the cache starts out empty. Saving writes a temporary file and renames it,
+* so a crash never leaves a truncated cache behind.
+*/
+class pipeline_cache {
+public:
+	struct statistics {
+		uint32_t hits; // pipelines the driver found in the cache
+		uint32_t misses;
+		uint32_t unknown; // the driver did not report feedback
+		uint64_t creation_time_ns;
+	};
+
+	bool initialize(VkPhysicalDevice physical_device, VkDevice device, const char* path);
+	// saves the cache and destroys it
+	void destroy();
+
+	bool save() const;
+	// adds the pipelines of another cache, e.g. one that was used by a worker thread
+	bool merge(VkPipelineCache source);
+
+	VkPipelineCache get_handle() const { return m_handle; }
+
+	// counts a pipeline creation. The feedback comes from VkPipelineCreationFeedbackCreateInfo. Thread safe
+	void record(const VkPipelineCreationFeedback& feedback);
+	statistics get_statistics() const;
+
+private:
+	bool is_compatible(const void* data, size_t size) const;
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkPipelineCache m_handle = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties m_properties{};
+	std::string m_path;
+	statistics m_statistics{};
+	mutable std::mutex m_statistics_mutex;
+};
+
+#endif //ENGINE_RENDERER_PIPELINE_CACHE_H
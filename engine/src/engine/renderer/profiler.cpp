@@ -0,0 +1,238 @@
+#include "profiler.h"
+#include "context.h"
+#include <stdio.h>
+
+// queries of a frame slot: 0 and 1 enclose the whole frame, followed by a begin and end query per scope
+
+bool profiler::initialize(uint32_t frames_in_flight) {
+	destroy();
+	m_start_time = std::chrono::steady_clock::now();
+	m_slots.resize(frames_in_flight);
+	for (frame_slot& slot : m_slots)
+		slot.pending = false;
+	m_history.reserve(HISTORY_SIZE);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(context::get_physical_device(), &properties);
+
+	uint32_t family_count;
+	vkGetPhysicalDeviceQueueFamilyProperties(context::get_physical_device(), &family_count, NULL);
+	std::vector<VkQueueFamilyProperties> families(family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(context::get_physical_device(), &family_count, families.data());
+	uint32_t valid_bits = families[context::get_queue_families().graphics].timestampValidBits;
+
+	// cpu scopes still work without timestamps
+	if (valid_bits == 0 || properties.limits.timestampPeriod == 0.0f)
+		return true;
+	m_timestamp_period = properties.limits.timestampPeriod;
+	m_timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+	VkQueryPoolCreateInfo create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	create_info.pNext = NULL;
+	create_info.flags = 0;
+	create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	create_info.queryCount = first_query(frames_in_flight);
+	create_info.pipelineStatistics = 0;
+	return vkCreateQueryPool(context::get_device(), &create_info, NULL, &m_query_pool) == VK_SUCCESS;
+}
+
+void profiler::destroy() {
+	if (m_query_pool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(context::get_device(), m_query_pool, NULL);
+	m_query_pool = VK_NULL_HANDLE;
+	m_slots.clear();
+	m_history.clear();
+	m_history_next = 0;
+	m_gpu_frame_open = false;
+}
+
+double profiler::now_ms() const {
+	return 1e-3 * std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start_time).count();
+}
+
+void profiler::new_frame(uint32_t frame_index) {
+	m_current_slot = frame_index;
+	m_current.frame_number = m_frame_number++;
+	m_current.cpu_begin_ms = now_ms();
+	m_current.cpu_frame_ms = 0.0;
+	m_current.gpu_frame_ms = 0.0;
+	m_current.cpu_scopes.clear();
+	m_current.gpu_scopes.clear();
+	m_cpu_depth = 0;
+	m_gpu_depth = 0;
+	m_gpu_frame_open = false;
+}
+
+void profiler::begin_gpu_frame(command_buffer& cmd_buf) {
+	if (m_query_pool == VK_NULL_HANDLE || m_slots.empty())
+		return;
+
+	// the fence of this slot has signaled, so the results of the frame that used it last are available
+	frame_slot& slot = m_slots[m_current_slot];
+	if (slot.pending)
+		resolve(slot);
+	slot.stats.gpu_scopes.clear();
+	slot.gpu_scope_ended.clear();
+
+	if (!m_enabled)
+		return;
+	uint32_t first = first_query(m_current_slot);
+	vkCmdResetQueryPool(cmd_buf.get_handle(), m_query_pool, first, 2 + 2 * MAX_GPU_SCOPES);
+	vkCmdWriteTimestamp(cmd_buf.get_handle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_query_pool, first);
+	m_gpu_frame_open = true;
+}
+
+void profiler::end_gpu_frame(command_buffer& cmd_buf) {
+	if (!m_gpu_frame_open)
+		return;
+
+	// scopes that were never closed would leave their queries unavailable forever
+	frame_slot& slot = m_slots[m_current_slot];
+	uint32_t first = first_query(m_current_slot);
+	for (uint32_t i = 0; i < (uint32_t)slot.gpu_scope_ended.size(); i++) {
+		if (!slot.gpu_scope_ended[i])
+			end_gpu_scope(cmd_buf, i);
+	}
+	vkCmdWriteTimestamp(cmd_buf.get_handle(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_query_pool, first + 1);
+}
+
+void profiler::end_frame() {
+	m_current.cpu_frame_ms = now_ms() - m_current.cpu_begin_ms;
+	if (!m_gpu_frame_open) {
+		publish(m_current);
+		return;
+	}
+
+	// the gpu part is added once the queries are read back
+	frame_slot& slot = m_slots[m_current_slot];
+	std::vector<scope_timing> gpu_scopes = std::move(slot.stats.gpu_scopes);
+	slot.stats = m_current;
+	slot.stats.gpu_scopes = std::move(gpu_scopes);
+	slot.pending = true;
+	m_gpu_frame_open = false;
+}
+
+uint32_t profiler::begin_cpu_scope(const char* name) {
+	if (!m_enabled || m_current.cpu_scopes.size() >= MAX_CPU_SCOPES)
+		return INVALID_SCOPE;
+	scope_timing& scope = m_current.cpu_scopes.emplace_back();
+	scope.name = name;
+	scope.begin_ms = now_ms() - m_current.cpu_begin_ms;
+	scope.duration_ms = 0.0;
+	scope.depth = m_cpu_depth++;
+	return (uint32_t)m_current.cpu_scopes.size() - 1;
+}
+
+void profiler::end_cpu_scope(uint32_t scope) {
+	if (scope == INVALID_SCOPE || scope >= m_current.cpu_scopes.size())
+		return;
+	scope_timing& timing = m_current.cpu_scopes[scope];
+	timing.duration_ms = now_ms() - m_current.cpu_begin_ms - timing.begin_ms;
+	m_cpu_depth--;
+}
+
+uint32_t profiler::begin_gpu_scope(command_buffer& cmd_buf, const char* name) {
+	if (!m_gpu_frame_open)
+		return INVALID_SCOPE;
+	frame_slot& slot = m_slots[m_current_slot];
+	if (slot.stats.gpu_scopes.size() >= MAX_GPU_SCOPES)
+		return INVALID_SCOPE;
+
+	uint32_t scope = (uint32_t)slot.stats.gpu_scopes.size();
+	scope_timing& timing = slot.stats.gpu_scopes.emplace_back();
+	timing.name = name;
+	timing.begin_ms = 0.0;
+	timing.duration_ms = 0.0;
+	timing.depth = m_gpu_depth++;
+	slot.gpu_scope_ended.push_back(false);
+
+	vkCmdWriteTimestamp(cmd_buf.get_handle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_query_pool, first_query(m_current_slot) + 2 + 2 * scope);
+	return scope;
+}
+
+void profiler::end_gpu_scope(command_buffer& cmd_buf, uint32_t scope) {
+	if (!m_gpu_frame_open || scope == INVALID_SCOPE)
+		return;
+	frame_slot& slot = m_slots[m_current_slot];
+	if (scope >= slot.gpu_scope_ended.size() || slot.gpu_scope_ended[scope])
+		return;
+	slot.gpu_scope_ended[scope] = true;
+	m_gpu_depth--;
+
+	vkCmdWriteTimestamp(cmd_buf.get_handle(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_query_pool, first_query(m_current_slot) + 3 + 2 * scope);
+}
+
+void profiler::resolve(frame_slot& slot) {
+	slot.pending = false;
+	uint32_t slot_index = (uint32_t)(&slot - m_slots.data());
+	uint32_t query_count = 2 + 2 * (uint32_t)slot.stats.gpu_scopes.size();
+
+	uint64_t timestamps[2 + 2 * MAX_GPU_SCOPES];
+	VkResult res = vkGetQueryPoolResults(context::get_device(), m_query_pool, first_query(slot_index), query_count,
+		sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (res != VK_SUCCESS) {
+		// never wait. Without results the frame is published with cpu timings only
+		slot.stats.gpu_scopes.clear();
+		publish(slot.stats);
+		return;
+	}
+
+	double ms_per_tick = m_timestamp_period * 1e-6;
+	uint64_t frame_begin = timestamps[0];
+	slot.stats.gpu_frame_ms = (double)((timestamps[1] - frame_begin) & m_timestamp_mask) * ms_per_tick;
+	for (uint32_t i = 0; i < (uint32_t)slot.stats.gpu_scopes.size(); i++) {
+		scope_timing& timing = slot.stats.gpu_scopes[i];
+		uint64_t begin = timestamps[2 + 2 * i];
+		uint64_t end = timestamps[3 + 2 * i];
+		timing.begin_ms = (double)((begin - frame_begin) & m_timestamp_mask) * ms_per_tick;
+		timing.duration_ms = (double)((end - begin) & m_timestamp_mask) * ms_per_tick;
+	}
+	publish(slot.stats);
+}
+
+void profiler::publish(const frame_stats& stats) {
+	m_last_stats = stats;
+	if (m_history.size() < HISTORY_SIZE)
+		m_history.push_back(stats);
+	else
+		m_history[m_history_next] = stats;
+	m_history_next = (m_history_next + 1) % HISTORY_SIZE;
+}
+
+static void write_event(FILE* file, bool* first, const char* name, double ts_ms, double duration_ms, uint32_t tid) {
+	fprintf(file, "%s\n{\"name\":\"", *first ? "" : ",");
+	for (const char* c = name; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fputc('\\', file);
+		fputc(*c, file);
+	}
+	fprintf(file, "\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", tid, ts_ms * 1e3, duration_ms * 1e3);
+	*first = false;
+}
+
+// cpu events are on thread 0, gpu events on thread 1. The gpu timeline is not calibrated against the cpu clock,
+// so every gpu frame is drawn as if it started together with its cpu frame
+bool profiler::write_chrome_trace(const char* path) const {
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+		return false;
+
+	fprintf(file, "{\"traceEvents\":[");
+	bool first = true;
+	size_t oldest = m_history.size() < HISTORY_SIZE ? 0 : m_history_next;
+	for (size_t i = 0; i < m_history.size(); i++) {
+		const frame_stats& stats = m_history[(oldest + i) % m_history.size()];
+		write_event(file, &first, "frame", stats.cpu_begin_ms, stats.cpu_frame_ms, 0);
+		for (const scope_timing& scope : stats.cpu_scopes)
+			write_event(file, &first, scope.name, stats.cpu_begin_ms + scope.begin_ms, scope.duration_ms, 0);
+
+		if (stats.gpu_frame_ms == 0.0)
+			continue;
+		write_event(file, &first, "gpu frame", stats.cpu_begin_ms, stats.gpu_frame_ms, 1);
+		for (const scope_timing& scope : stats.gpu_scopes)
+			write_event(file, &first, scope.name, stats.cpu_begin_ms + scope.begin_ms, scope.duration_ms, 1);
+	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
@@ -0,0 +1,122 @@
+#ifndef ENGINE_RENDERER_PROFILER_H
+#define ENGINE_RENDERER_PROFILER_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+#include "command_buffer.h"
+
+/*
+* Frame profiler for cpu scopes and gpu scopes.
+* Gpu scopes are timestamp queries. Every frame in flight has its own range of queries, which is read back
+* when the frame that reuses the range begins. Its fence has signaled by then, so reading never stalls.
+* The results of a frame are therefore published frames_in_flight frames later.
+* Scope names must be string literals or otherwise outlive the profiler.
+*/
+class profiler {
+public:
+	static constexpr uint32_t MAX_GPU_SCOPES = 64;
+	static constexpr uint32_t MAX_CPU_SCOPES = 256;
+	static constexpr uint32_t HISTORY_SIZE = 256;
+
+	struct scope_timing {
+		const char* name;
+		double begin_ms; // relative to the start of the frame on the cpu or gpu timeline
+		double duration_ms;
+		uint32_t depth;
+	};
+
+	struct frame_stats {
+		uint64_t frame_number;
+		double cpu_begin_ms; // relative to the initialization of the profiler
+		double cpu_frame_ms;
+		double gpu_frame_ms; // 0 if the device has no timestamp support
+		std::vector<scope_timing> cpu_scopes;
+		std::vector<scope_timing> gpu_scopes;
+	};
+
+	profiler() = default;
+	~profiler() { destroy(); }
+	profiler(const profiler&) = delete;
+	profiler& operator=(const profiler&) = delete;
+
+	bool initialize(uint32_t frames_in_flight);
+	void destroy();
+
+	// frame flow: new_frame -> (fence wait) -> begin_gpu_frame -> scopes -> end_gpu_frame -> end_frame
+	void new_frame(uint32_t frame_index);
+	// reads back the queries of this frame slot and resets them. Must be recorded outside of a render pass
+	void begin_gpu_frame(command_buffer& cmd_buf);
+	void end_gpu_frame(command_buffer& cmd_buf);
+	void end_frame();
+
+	uint32_t begin_cpu_scope(const char* name);
+	void end_cpu_scope(uint32_t scope);
+	// returns an invalid scope if timestamps are not supported or too many scopes were opened this frame
+	uint32_t begin_gpu_scope(command_buffer& cmd_buf, const char* name);
+	void end_gpu_scope(command_buffer& cmd_buf, uint32_t scope);
+
+	class cpu_scope {
+	public:
+		cpu_scope(profiler& profiler, const char* name) : m_profiler(profiler), m_scope(profiler.begin_cpu_scope(name)) {}
+		~cpu_scope() { m_profiler.end_cpu_scope(m_scope); }
+	private:
+		profiler& m_profiler;
+		uint32_t m_scope;
+	};
+
+	class gpu_scope {
+	public:
+		gpu_scope(profiler& profiler, command_buffer& cmd_buf, const char* name) : m_profiler(profiler), m_cmd_buf(cmd_buf), m_scope(profiler.begin_gpu_scope(cmd_buf, name)) {}
+		~gpu_scope() { m_profiler.end_gpu_scope(m_cmd_buf, m_scope); }
+	private:
+		profiler& m_profiler;
+		command_buffer& m_cmd_buf;
+		uint32_t m_scope;
+	};
+
+	void set_enabled(bool enabled) { m_enabled = enabled; }
+	bool is_enabled() const { return m_enabled; }
+	bool has_gpu_timestamps() const { return m_query_pool != VK_NULL_HANDLE; }
+
+	// the most recent frame whose gpu results are available
+	const frame_stats& get_last_frame_stats() const { return m_last_stats; }
+	// writes the retained frames in the chrome trace event format (chrome://tracing, perfetto)
+	bool write_chrome_trace(const char* path) const;
+
+private:
+	static constexpr uint32_t INVALID_SCOPE = 0xFFFFFFFF;
+
+	// everything that is recorded for a frame until its gpu results are read back
+	struct frame_slot {
+		frame_stats stats;
+		std::vector<bool> gpu_scope_ended;
+		bool pending;
+	};
+
+	double now_ms() const;
+	uint32_t first_query(uint32_t slot) const { return slot * (2 + 2 * MAX_GPU_SCOPES); }
+	void resolve(frame_slot& slot);
+	void publish(const frame_stats& stats);
+
+	bool m_enabled = true;
+	VkQueryPool m_query_pool = VK_NULL_HANDLE;
+	double m_timestamp_period = 1.0; // nanoseconds per tick
+	uint64_t m_timestamp_mask = ~0ull;
+
+	std::chrono::steady_clock::time_point m_start_time;
+	uint64_t m_frame_number = 0;
+	uint32_t m_current_slot = 0;
+	uint32_t m_cpu_depth = 0;
+	uint32_t m_gpu_depth = 0;
+	bool m_gpu_frame_open = false;
+	frame_stats m_current{}; // cpu data of the frame that is being recorded
+	std::vector<frame_slot> m_slots;
+
+	frame_stats m_last_stats{};
+	std::vector<frame_stats> m_history; // ring buffer of the last HISTORY_SIZE frames
+	size_t m_history_next = 0;
+};
+
+#endif //ENGINE_RENDERER_PROFILER_H
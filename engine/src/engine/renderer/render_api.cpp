@@ -2,6 +2,8 @@
 #include <vulkan/vulkan.h>
 #include <vector>
 #include <stdio.h>
+#include <string.h>
+#include "engine/core/log.h"
 
 
 static bool create_vk_instance();
@@ -17,8 +19,14 @@ VkBool32 validation_callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
 	VkDebugUtilsMessageTypeFlagsEXT                  msg_type,
 	const VkDebugUtilsMessengerCallbackDataEXT* data,
 	void* pUserData) {
-	printf("validation: %s\n", data->pMessage);
-	__debugbreak();
+	if (severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+		err("validation: %s\n", data->pMessage);
+#ifdef DEBUG
+		debug_break();
+#endif
+	}else {
+		printf("validation: %s\n", data->pMessage);
+	}
 
 	return VK_FALSE;
 }
@@ -120,8 +128,8 @@ bool create_vk_instance() {
 #endif
 	};
 	std::vector<const char*> required_extensions = {
-		VK_KHR_SURFACE_EXTENSION_NAME,
 #ifdef PLATFORM_WINDOWS
+		VK_KHR_SURFACE_EXTENSION_NAME,
 		"VK_KHR_win32_surface",
 #endif
 #ifndef DISTRIBUTION
@@ -131,8 +139,11 @@ bool create_vk_instance() {
 
 	if (!check_required_extensions(required_extensions))
 		return false;
-	if (!check_required_layers(required_layers))
-		return false;
+	if (!check_required_layers(required_layers)) {
+		// machines without the sdk (e.g. build servers) still have to be able to run
+		err("Validation layers are not available. Continuing without them\n");
+		required_layers.clear();
+	}
 
 	VkApplicationInfo app_info = { };
 	app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -0,0 +1,590 @@
+#include "render_graph.h"
+#include "context.h"
+#include "engine/core/log.h"
+#include <algorithm>
+#include <assert.h>
+
+static constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+	| VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+render_graph::pass::resource_use& render_graph::pass::add_use(resource_handle resource, use_type type) {
+	resource_use& use = m_uses.emplace_back();
+	use.resource = resource;
+	use.type = type;
+	use.stages = 0;
+	use.access = 0;
+	use.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	use.read = false;
+	use.write = false;
+	use.load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	use.clear_value = {};
+	return use;
+}
+
+render_graph::pass& render_graph::pass::write_color(resource_handle image, VkAttachmentLoadOp load_op, VkClearColorValue clear_value) {
+	resource_use& use = add_use(image, use_type::COLOR_ATTACHMENT);
+	use.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	use.access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	use.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	use.write = true;
+	use.read = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+	if (use.read)
+		use.access |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+	use.load_op = load_op;
+	use.clear_value.color = clear_value;
+	return *this;
+}
+
+render_graph::pass& render_graph::pass::write_depth_stencil(resource_handle image, VkAttachmentLoadOp load_op, VkClearDepthStencilValue clear_value) {
+	resource_use& use = add_use(image, use_type::DEPTH_STENCIL_ATTACHMENT);
+	use.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	// the depth test reads the attachment even if the old contents were cleared
+	use.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	use.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	use.write = true;
+	use.read = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+	use.load_op = load_op;
+	use.clear_value.depthStencil = clear_value;
+	return *this;
+}
+
+render_graph::pass& render_graph::pass::read_depth_stencil(resource_handle image) {
+	resource_use& use = add_use(image, use_type::DEPTH_STENCIL_ATTACHMENT);
+	use.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	use.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+	use.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	use.read = true;
+	use.load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
+	return *this;
+}
+
+render_graph::pass& render_graph::pass::read_texture(resource_handle image, VkPipelineStageFlags stages) {
+	resource_use& use = add_use(image, use_type::TEXTURE);
+	use.stages = stages;
+	use.access = VK_ACCESS_SHADER_READ_BIT;
+	use.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	use.read = true;
+	return *this;
+}
+
+render_graph::pass& render_graph::pass::read_buffer(resource_handle buffer, VkPipelineStageFlags stages, VkAccessFlags access) {
+	resource_use& use = add_use(buffer, use_type::BUFFER);
+	use.stages = stages;
+	use.access = access;
+	use.read = true;
+	return *this;
+}
+
+render_graph::pass& render_graph::pass::write_buffer(resource_handle buffer, VkPipelineStageFlags stages, VkAccessFlags access) {
+	resource_use& use = add_use(buffer, use_type::BUFFER);
+	use.stages = stages;
+	use.access = access;
+	use.write = true;
+	// a shader that writes parts of a buffer keeps the rest
+	use.read = (access & ~WRITE_ACCESS) != 0;
+	return *this;
+}
+
+
+render_graph::resource_handle render_graph::create_image(const char* name, const image_description& description) {
+	assert(!m_compiled_graph && "resources can not be added to a compiled graph");
+	resource& res = m_resources.emplace_back();
+	res.name = name;
+	res.is_image = true;
+	res.imported = false;
+	res.description = description;
+	return (resource_handle)m_resources.size() - 1;
+}
+
+render_graph::resource_handle render_graph::import_image(const char* name, const image_description& description, VkImageLayout initial_layout, VkPipelineStageFlags initial_stages, VkImageLayout final_layout) {
+	assert(!m_compiled_graph && "resources can not be added to a compiled graph");
+	resource& res = m_resources.emplace_back();
+	res.name = name;
+	res.is_image = true;
+	res.imported = true;
+	res.description = description;
+	res.initial_layout = initial_layout;
+	res.initial_stages = initial_stages;
+	res.final_layout = final_layout;
+	return (resource_handle)m_resources.size() - 1;
+}
+
+render_graph::resource_handle render_graph::import_buffer(const char* name, VkBuffer buffer) {
+	assert(!m_compiled_graph && "resources can not be added to a compiled graph");
+	resource& res = m_resources.emplace_back();
+	res.name = name;
+	res.is_image = false;
+	res.imported = true;
+	res.description = {};
+	res.buffer = buffer;
+	return (resource_handle)m_resources.size() - 1;
+}
+
+void render_graph::set_image(resource_handle image, VkImage handle, VkImageView view) {
+	assert(m_resources[image].is_image && m_resources[image].imported);
+	m_resources[image].image = handle;
+	m_resources[image].view = view;
+}
+
+void render_graph::set_buffer(resource_handle buffer, VkBuffer handle) {
+	assert(!m_resources[buffer].is_image);
+	m_resources[buffer].buffer = handle;
+}
+
+void render_graph::set_output(resource_handle resource) {
+	m_resources[resource].output = true;
+}
+
+render_graph::pass& render_graph::add_pass(const char* name) {
+	assert(!m_compiled_graph && "passes can not be added to a compiled graph");
+	pass& p = m_passes.emplace_back();
+	p.m_name = name;
+	return p;
+}
+
+uint32_t render_graph::index_of(const pass& p) const {
+	for (uint32_t i = 0; i < (uint32_t)m_passes.size(); i++) {
+		if (&m_passes[i] == &p)
+			return i;
+	}
+	return UINT32_MAX;
+}
+
+bool render_graph::is_culled(const pass& p) const {
+	uint32_t index = index_of(p);
+	return index >= m_compiled.size() || m_compiled[index].culled;
+}
+
+
+bool render_graph::compile() {
+	assert(!m_compiled_graph && "the graph is already compiled");
+	m_compiled.clear();
+	m_compiled.resize(m_passes.size());
+	m_statistics = {};
+	m_statistics.pass_count = (uint32_t)m_passes.size();
+
+	cull_passes();
+	compute_lifetimes();
+	if (!create_transient_images())
+		return false;
+	compute_barriers();
+	prepare_attachments();
+
+	m_compiled_graph = true;
+	return true;
+}
+
+// walks the passes backwards. A pass survives if it writes something that is needed later,
+// the resources it reads are then needed from the passes in front of it
+void render_graph::cull_passes() {
+	std::vector<bool> needed(m_resources.size(), false);
+	for (uint32_t i = 0; i < (uint32_t)m_resources.size(); i++)
+		needed[i] = m_resources[i].output;
+
+	for (uint32_t i = (uint32_t)m_passes.size(); i-- > 0;) {
+		const pass& p = m_passes[i];
+		bool keep = p.m_side_effects;
+		for (const pass::resource_use& use : p.m_uses)
+			keep |= use.write && needed[use.resource];
+		m_compiled[i].culled = !keep;
+		if (!keep) {
+			m_statistics.culled_pass_count++;
+			continue;
+		}
+		// a complete overwrite makes the earlier contents irrelevant
+		for (const pass::resource_use& use : p.m_uses) {
+			if (use.write && !use.read)
+				needed[use.resource] = false;
+		}
+		for (const pass::resource_use& use : p.m_uses) {
+			if (use.read)
+				needed[use.resource] = true;
+		}
+	}
+}
+
+void render_graph::compute_lifetimes() {
+	for (uint32_t i = 0; i < (uint32_t)m_passes.size(); i++) {
+		if (m_compiled[i].culled)
+			continue;
+		for (const pass::resource_use& use : m_passes[i].m_uses) {
+			resource& res = m_resources[use.resource];
+			res.first_pass = std::min(res.first_pass, i);
+			res.last_pass = std::max(res.last_pass, i);
+			if (use.type == pass::use_type::COLOR_ATTACHMENT)
+				res.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+			else if (use.type == pass::use_type::DEPTH_STENCIL_ATTACHMENT)
+				res.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+			else if (use.type == pass::use_type::TEXTURE)
+				res.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+		}
+	}
+}
+
+bool render_graph::create_transient_images() {
+	VkDevice device = context::get_device();
+	std::vector<resource_handle> transients;
+	std::vector<VkMemoryRequirements> requirements(m_resources.size());
+	for (resource_handle handle = 0; handle < (resource_handle)m_resources.size(); handle++) {
+		resource& res = m_resources[handle];
+		// images that only culled passes use are never created
+		if (!res.is_image || res.imported || res.first_pass == UINT32_MAX)
+			continue;
+
+		VkImageCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		create_info.pNext = NULL;
+		create_info.flags = 0;
+		create_info.imageType = VK_IMAGE_TYPE_2D;
+		create_info.format = res.description.format;
+		create_info.extent = { res.description.width, res.description.height, 1 };
+		create_info.mipLevels = 1;
+		create_info.arrayLayers = 1;
+		create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		create_info.usage = res.usage;
+		create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		create_info.queueFamilyIndexCount = 0;
+		create_info.pQueueFamilyIndices = NULL;
+		create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		if (vkCreateImage(device, &create_info, NULL, &res.image) != VK_SUCCESS) {
+			err("Failed to create the transient image %s\n", res.name.c_str());
+			return false;
+		}
+		vkGetImageMemoryRequirements(device, res.image, &requirements[handle]);
+		m_statistics.unaliased_transient_memory += requirements[handle].size;
+		transients.push_back(handle);
+	}
+
+	// the largest images pick their slots first, the smaller ones then fill the gaps
+	std::sort(transients.begin(), transients.end(), [&requirements](resource_handle a, resource_handle b) {
+		return requirements[a].size > requirements[b].size;
+	});
+	for (resource_handle handle : transients) {
+		resource& res = m_resources[handle];
+		const VkMemoryRequirements& req = requirements[handle];
+		for (uint32_t slot_index = 0; slot_index < (uint32_t)m_memory_slots.size() && res.memory_slot == UINT32_MAX; slot_index++) {
+			memory_slot& slot = m_memory_slots[slot_index];
+			if ((slot.requirements.memoryTypeBits & req.memoryTypeBits) == 0)
+				continue;
+			bool overlaps = false;
+			for (resource_handle other : slot.images) {
+				const resource& o = m_resources[other];
+				overlaps |= res.first_pass <= o.last_pass && o.first_pass <= res.last_pass;
+			}
+			if (overlaps)
+				continue;
+			slot.requirements.size = std::max(slot.requirements.size, req.size);
+			slot.requirements.alignment = std::max(slot.requirements.alignment, req.alignment);
+			slot.requirements.memoryTypeBits &= req.memoryTypeBits;
+			slot.images.push_back(handle);
+			res.memory_slot = slot_index;
+		}
+		if (res.memory_slot != UINT32_MAX)
+			continue;
+		memory_slot& slot = m_memory_slots.emplace_back();
+		slot.requirements = req;
+		slot.images.push_back(handle);
+		res.memory_slot = (uint32_t)m_memory_slots.size() - 1;
+	}
+
+	allocator& allocator = context::get_memory_allocator();
+	for (memory_slot& slot : m_memory_slots) {
+		std::sort(slot.images.begin(), slot.images.end(), [this](resource_handle a, resource_handle b) {
+			return m_resources[a].first_pass < m_resources[b].first_pass;
+		});
+		slot.memory = allocator.allocate(slot.requirements, allocator::access_flags::STATIC, allocator::tiling::OPTIMAL);
+		if (!slot.memory) {
+			err("Failed to allocate memory for transient images\n");
+			return false;
+		}
+		m_statistics.transient_memory += slot.requirements.size;
+		for (resource_handle handle : slot.images) {
+			resource& res = m_resources[handle];
+			if (vkBindImageMemory(device, res.image, slot.memory.handle, slot.memory.start_address) != VK_SUCCESS)
+				return false;
+			if ((res.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)) != 0
+				&& !create_image_view(res.image, res.description.format, &res.view))
+				return false;
+		}
+	}
+	return true;
+}
+
+void render_graph::compute_barriers() {
+	// the stages and writes of every resource over the whole frame. The next frame, or the next image in the
+	// same memory, has to wait for all of them
+	std::vector<VkPipelineStageFlags> all_stages(m_resources.size(), 0);
+	std::vector<VkAccessFlags> all_writes(m_resources.size(), 0);
+	for (uint32_t i = 0; i < (uint32_t)m_passes.size(); i++) {
+		if (m_compiled[i].culled)
+			continue;
+		for (const pass::resource_use& use : m_passes[i].m_uses) {
+			all_stages[use.resource] |= use.stages;
+			all_writes[use.resource] |= use.access & WRITE_ACCESS;
+		}
+	}
+
+	struct resource_state {
+		VkImageLayout layout;
+		VkPipelineStageFlags write_stages; // the last write or layout transition
+		VkAccessFlags write_access;
+		VkPipelineStageFlags read_stages; // reads since the last write
+		VkPipelineStageFlags visible_stages; // stages that already waited for the last write
+		VkAccessFlags visible_access;
+	};
+	std::vector<resource_state> states(m_resources.size());
+	for (resource_handle handle = 0; handle < (resource_handle)m_resources.size(); handle++) {
+		const resource& res = m_resources[handle];
+		resource_state& state = states[handle];
+		state = {};
+		if (res.is_image && res.imported) {
+			state.layout = res.initial_layout;
+			state.write_stages = res.initial_stages;
+		}else if (res.is_image) {
+			// the previous image in the same memory. The first one follows the last one of the previous frame
+			state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			if (res.memory_slot != UINT32_MAX) {
+				const std::vector<resource_handle>& images = m_memory_slots[res.memory_slot].images;
+				size_t position = std::find(images.begin(), images.end(), handle) - images.begin();
+				resource_handle previous = images[(position + images.size() - 1) % images.size()];
+				state.write_stages = all_stages[previous];
+				state.write_access = all_writes[previous];
+			}
+		}else {
+			// the same buffer in the previous frame
+			state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			state.write_stages = all_stages[handle];
+			state.write_access = all_writes[handle];
+		}
+	}
+
+	for (uint32_t i = 0; i < (uint32_t)m_passes.size(); i++) {
+		if (m_compiled[i].culled)
+			continue;
+		barrier_batch& batch = m_compiled[i].barriers;
+		for (const pass::resource_use& use : m_passes[i].m_uses) {
+			const resource& res = m_resources[use.resource];
+			resource_state& state = states[use.resource];
+			bool layout_change = res.is_image && use.layout != state.layout;
+
+			if (layout_change || use.write) {
+				// everything before has to be done. Earlier reads only need the execution dependency
+				VkPipelineStageFlags src_stages = state.write_stages | state.read_stages;
+				if (src_stages != 0 || layout_change) {
+					batch.src_stages |= src_stages != 0 ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+					batch.dst_stages |= use.stages;
+					if (res.is_image) {
+						image_barrier& barrier = batch.images.emplace_back();
+						barrier.image = use.resource;
+						// contents that are overwritten completely do not have to be transitioned
+						barrier.old_layout = use.read ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+						barrier.new_layout = use.layout;
+						barrier.src_access = state.write_access;
+						barrier.dst_access = use.access;
+					}else {
+						batch.src_access |= state.write_access;
+						batch.dst_access |= use.access;
+					}
+				}
+				state.layout = use.layout;
+				state.write_stages = use.stages;
+				state.write_access = use.write ? use.access & WRITE_ACCESS : 0;
+				state.read_stages = use.write ? 0 : use.stages;
+				state.visible_stages = use.stages;
+				state.visible_access = use.access;
+				continue;
+			}
+
+			// reads in the same layout only wait for the last write, and only once
+			if (state.write_stages != 0 && ((use.stages & ~state.visible_stages) != 0 || (use.access & ~state.visible_access) != 0)) {
+				batch.src_stages |= state.write_stages;
+				batch.dst_stages |= use.stages;
+				if (res.is_image) {
+					image_barrier& barrier = batch.images.emplace_back();
+					barrier.image = use.resource;
+					barrier.old_layout = state.layout;
+					barrier.new_layout = state.layout;
+					barrier.src_access = state.write_access;
+					barrier.dst_access = use.access;
+				}else {
+					batch.src_access |= state.write_access;
+					batch.dst_access |= use.access;
+				}
+				state.visible_stages |= use.stages;
+				state.visible_access |= use.access;
+			}
+			state.read_stages |= use.stages;
+		}
+		if (batch.src_stages != 0)
+			m_statistics.barrier_count++;
+		m_statistics.image_barrier_count += (uint32_t)batch.images.size();
+	}
+
+	m_final_barriers = {};
+	for (resource_handle handle = 0; handle < (resource_handle)m_resources.size(); handle++) {
+		const resource& res = m_resources[handle];
+		const resource_state& state = states[handle];
+		if (!res.is_image || !res.imported || res.final_layout == VK_IMAGE_LAYOUT_UNDEFINED || res.final_layout == state.layout)
+			continue;
+		VkPipelineStageFlags src_stages = state.write_stages | state.read_stages;
+		m_final_barriers.src_stages |= src_stages != 0 ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		m_final_barriers.dst_stages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		image_barrier& barrier = m_final_barriers.images.emplace_back();
+		barrier.image = handle;
+		barrier.old_layout = state.layout;
+		barrier.new_layout = res.final_layout;
+		barrier.src_access = state.write_access;
+		barrier.dst_access = 0;
+	}
+	if (m_final_barriers.src_stages != 0)
+		m_statistics.barrier_count++;
+	m_statistics.image_barrier_count += (uint32_t)m_final_barriers.images.size();
+}
+
+// the attachments are already in their layouts when the rendering begins, the barriers of the graph put them there
+void render_graph::prepare_attachments() {
+	for (uint32_t i = 0; i < (uint32_t)m_passes.size(); i++) {
+		compiled_pass& compiled = m_compiled[i];
+		if (compiled.culled)
+			continue;
+
+		for (const pass::resource_use& use : m_passes[i].m_uses) {
+			if (use.type != pass::use_type::COLOR_ATTACHMENT && use.type != pass::use_type::DEPTH_STENCIL_ATTACHMENT)
+				continue;
+			const resource& res = m_resources[use.resource];
+			command_buffer::rendering_attachment attachment;
+			attachment.view = VK_NULL_HANDLE;
+			attachment.layout = use.layout;
+			attachment.load_op = use.load_op;
+			// nobody looks at a transient image after its last pass
+			bool discard = !res.imported && !res.output && res.last_pass == i;
+			attachment.store_op = discard ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+			// a store would be a write. Read only attachments are left untouched
+			if (!use.write)
+				attachment.store_op = VK_ATTACHMENT_STORE_OP_NONE;
+			attachment.clear_value = use.clear_value;
+
+			if (use.type == pass::use_type::COLOR_ATTACHMENT) {
+				compiled.color_images.push_back(use.resource);
+				compiled.color_attachments.push_back(attachment);
+				compiled.color_formats.push_back(res.description.format);
+			}else {
+				assert(compiled.depth_image == INVALID_RESOURCE && "a pass has only one depth stencil attachment");
+				compiled.depth_image = use.resource;
+				compiled.depth_attachment = attachment;
+				compiled.depth_format = res.description.format;
+			}
+			compiled.extent = { res.description.width, res.description.height };
+		}
+	}
+}
+
+void render_graph::record_barriers(command_buffer& cmd_buf, const barrier_batch& barriers) {
+	if (barriers.src_stages == 0)
+		return;
+	m_barrier_scratch.clear();
+	for (const image_barrier& image : barriers.images) {
+		const resource& res = m_resources[image.image];
+		VkImageMemoryBarrier& barrier = m_barrier_scratch.emplace_back();
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.pNext = NULL;
+		barrier.srcAccessMask = image.src_access;
+		barrier.dstAccessMask = image.dst_access;
+		barrier.oldLayout = image.old_layout;
+		barrier.newLayout = image.new_layout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = res.image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		if (res.usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+			if (has_stencil_component(res.description.format))
+				barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+		}
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+	}
+
+	VkMemoryBarrier memory_barrier = {};
+	memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memory_barrier.pNext = NULL;
+	memory_barrier.srcAccessMask = barriers.src_access;
+	memory_barrier.dstAccessMask = barriers.dst_access;
+	bool has_memory_barrier = barriers.src_access != 0 || barriers.dst_access != 0;
+
+	vkCmdPipelineBarrier(cmd_buf.get_handle(), barriers.src_stages, barriers.dst_stages != 0 ? barriers.dst_stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+		has_memory_barrier ? 1 : 0, has_memory_barrier ? &memory_barrier : NULL, 0, NULL, (uint32_t)m_barrier_scratch.size(), m_barrier_scratch.data());
+}
+
+void render_graph::execute(command_buffer& cmd_buf) {
+	assert(m_compiled_graph && "the graph has to be compiled before it is executed");
+	for (uint32_t i = 0; i < (uint32_t)m_passes.size(); i++) {
+		compiled_pass& compiled = m_compiled[i];
+		if (compiled.culled)
+			continue;
+		const pass& p = m_passes[i];
+		record_barriers(cmd_buf, compiled.barriers);
+
+		bool has_depth = compiled.depth_image != INVALID_RESOURCE;
+		bool renders = !compiled.color_images.empty() || has_depth;
+		if (renders) {
+			for (size_t a = 0; a < compiled.color_images.size(); a++)
+				compiled.color_attachments[a].view = m_resources[compiled.color_images[a]].view;
+			if (has_depth)
+				compiled.depth_attachment.view = m_resources[compiled.depth_image].view;
+			bool has_stencil = has_depth && has_stencil_component(compiled.depth_format);
+			cmd_buf.begin_rendering(compiled.extent, compiled.color_attachments.data(), (uint32_t)compiled.color_attachments.size(),
+				has_depth ? &compiled.depth_attachment : NULL, has_stencil ? &compiled.depth_attachment : NULL, p.m_secondary_contents);
+		}
+
+		pass_context info{ compiled.extent, compiled.color_formats.data(), (uint32_t)compiled.color_formats.size(), compiled.depth_format };
+		if (p.m_execute)
+			p.m_execute(cmd_buf, info);
+
+		if (renders)
+			cmd_buf.end_rendering();
+	}
+	record_barriers(cmd_buf, m_final_barriers);
+}
+
+void render_graph::destroy() {
+	if (context::get_current() == NULL)
+		return;
+	// frames in flight may still use the transient images
+	std::vector<VkImageView> views;
+	std::vector<VkImage> images;
+	for (resource& res : m_resources) {
+		if (!res.is_image || res.imported)
+			continue;
+		if (res.view != VK_NULL_HANDLE)
+			views.push_back(res.view);
+		if (res.image != VK_NULL_HANDLE)
+			images.push_back(res.image);
+	}
+	std::vector<allocator::sub_allocation> memory;
+	for (memory_slot& slot : m_memory_slots) {
+		if (slot.memory)
+			memory.push_back(slot.memory);
+	}
+	if (!views.empty() || !images.empty() || !memory.empty()) {
+		context::defer_destruction([views, images, memory]() {
+			for (VkImageView view : views)
+				vkDestroyImageView(context::get_device(), view, NULL);
+			for (VkImage image : images)
+				vkDestroyImage(context::get_device(), image, NULL);
+			for (const allocator::sub_allocation& allocation : memory)
+				context::get_memory_allocator().free(allocation);
+		});
+	}
+
+	m_compiled.clear();
+	m_memory_slots.clear();
+	m_resources.clear();
+	m_passes.clear();
+	m_final_barriers = {};
+	m_compiled_graph = false;
+	m_statistics = {};
+}
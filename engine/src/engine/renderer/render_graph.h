@@ -0,0 +1,205 @@
+#ifndef ENGINE_RENDERER_RENDER_GRAPH_H
+#define ENGINE_RENDERER_RENDER_GRAPH_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include "command_buffer.h"
+#include "memory.h"
+
+/*
+* Describes a frame as a list of passes and the images and buffers they read and write.
+* compile works out everything that used to be written by hand:
+*  - passes that contribute nothing to an output are culled
+*  - the barriers and layout transitions between the passes. Every pass gets at most one vkCmdPipelineBarrier
+*    and reads that follow each other in the same layout do not synchronize at all
+*  - transient images are created by the graph. Transient images whose lifetimes do not overlap share memory
+*  - passes with attachments render into them with dynamic rendering, so no render passes or framebuffers
+*    have to be created, not even when imported images change
+* The graph is built and compiled once and executed every frame. Imported images like the swapchain image
+* can be swapped with set_image between executions.
+*/
+class render_graph {
+public:
+	using resource_handle = uint32_t;
+	static constexpr resource_handle INVALID_RESOURCE = 0xFFFFFFFF;
+
+	struct image_description {
+		uint32_t width;
+		uint32_t height;
+		VkFormat format;
+	};
+
+	// pipelines for a pass are built with its attachment formats
+	struct pass_context {
+		VkExtent2D extent;
+		const VkFormat* color_formats;
+		uint32_t color_format_count;
+		VkFormat depth_format; // VK_FORMAT_UNDEFINED without depth attachment
+	};
+	using execute_function = std::function<void(command_buffer& cmd_buf, const pass_context& context)>;
+
+	class pass {
+	public:
+		// an attachment. LOAD keeps the contents, which makes the pass read the image as well
+		pass& write_color(resource_handle image, VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_CLEAR, VkClearColorValue clear_value = {});
+		pass& write_depth_stencil(resource_handle image, VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_CLEAR, VkClearDepthStencilValue clear_value = { 1.0f, 0 });
+		// a depth attachment that is tested against but not written, e.g. the result of a depth pre-pass
+		// in a pass that shades with VK_COMPARE_OP_EQUAL. The image stays in a read only depth layout,
+		// so sampling it later with read_texture still costs a layout transition
+		pass& read_depth_stencil(resource_handle image);
+		// sampled in the given shader stages
+		pass& read_texture(resource_handle image, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		pass& read_buffer(resource_handle buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+		pass& write_buffer(resource_handle buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+
+		// the pass records into secondary command buffers, see command_allocator::record_parallel.
+		// They inherit the rendering with a VkCommandBufferInheritanceRenderingInfo
+		pass& use_secondary_command_buffers() { m_secondary_contents = true; return *this; }
+		// the pass is kept even if none of its writes are used, e.g. because it writes to the host
+		pass& set_side_effects() { m_side_effects = true; return *this; }
+		pass& set_execute(execute_function execute) { m_execute = std::move(execute); return *this; }
+
+	private:
+		friend class render_graph;
+		enum class use_type {
+			COLOR_ATTACHMENT, DEPTH_STENCIL_ATTACHMENT, TEXTURE, BUFFER
+		};
+		struct resource_use {
+			resource_handle resource;
+			use_type type;
+			VkPipelineStageFlags stages;
+			VkAccessFlags access;
+			VkImageLayout layout; // undefined for buffers
+			bool read;
+			bool write;
+			VkAttachmentLoadOp load_op;
+			VkClearValue clear_value;
+		};
+		resource_use& add_use(resource_handle resource, use_type type);
+
+		std::string m_name;
+		std::vector<resource_use> m_uses; // in the order they were declared. Attachments keep that order
+		bool m_secondary_contents = false;
+		bool m_side_effects = false;
+		execute_function m_execute;
+	};
+
+	~render_graph() { destroy(); }
+
+	// an image that is created by the graph and whose contents do not outlive the frame
+	resource_handle create_image(const char* name, const image_description& description);
+	// an image that is owned by someone else. It arrives in initial_layout after initial_stages wrote or read it
+	// and is left in final_layout
+	resource_handle import_image(const char* name, const image_description& description, VkImageLayout initial_layout, VkPipelineStageFlags initial_stages, VkImageLayout final_layout);
+	resource_handle import_buffer(const char* name, VkBuffer buffer);
+	// replaces the handle of an imported resource, e.g. with the swapchain image of the frame.
+	// The view is needed if the image is an attachment
+	void set_image(resource_handle image, VkImage handle, VkImageView view = VK_NULL_HANDLE);
+	void set_buffer(resource_handle buffer, VkBuffer handle);
+	// the result of the frame. Only passes that contribute to outputs survive culling
+	void set_output(resource_handle resource);
+
+	// passes run in the order they are added. The reference stays valid until the graph is destroyed
+	pass& add_pass(const char* name);
+
+	// culls passes, computes the barriers and creates the transient images.
+	// Passes and resources can not be added afterwards
+	bool compile();
+	// records all passes that survived culling. The graph has to be compiled
+	void execute(command_buffer& cmd_buf);
+
+	void destroy();
+
+	// valid after compile
+	bool is_culled(const pass& p) const;
+
+	struct statistics {
+		uint32_t pass_count;
+		uint32_t culled_pass_count;
+		uint32_t barrier_count; // vkCmdPipelineBarrier calls per execution
+		uint32_t image_barrier_count;
+		VkDeviceSize transient_memory; // memory used by the transient images
+		VkDeviceSize unaliased_transient_memory; // memory they would need without aliasing
+	};
+	const statistics& get_statistics() const { return m_statistics; }
+
+private:
+	struct resource {
+		std::string name;
+		bool is_image;
+		bool imported;
+		image_description description;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags initial_stages = 0;
+		VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		bool output = false;
+
+		// set by compile
+		VkImageUsageFlags usage = 0;
+		uint32_t first_pass = UINT32_MAX; // first and last pass that survived culling and uses the resource
+		uint32_t last_pass = 0;
+		uint32_t memory_slot = UINT32_MAX; // transient images only
+	};
+
+	// memory that is shared by transient images whose lifetimes do not overlap
+	struct memory_slot {
+		VkMemoryRequirements requirements;
+		std::vector<resource_handle> images; // ordered by their first pass
+		allocator::sub_allocation memory;
+	};
+
+	struct image_barrier {
+		resource_handle image;
+		VkImageLayout old_layout;
+		VkImageLayout new_layout;
+		VkAccessFlags src_access;
+		VkAccessFlags dst_access;
+	};
+	// everything that has to happen before a pass, merged into one vkCmdPipelineBarrier
+	struct barrier_batch {
+		VkPipelineStageFlags src_stages = 0;
+		VkPipelineStageFlags dst_stages = 0;
+		VkAccessFlags src_access = 0; // global memory barrier. Used for buffers
+		VkAccessFlags dst_access = 0;
+		std::vector<image_barrier> images;
+	};
+
+	struct compiled_pass {
+		bool culled = true;
+		barrier_batch barriers;
+		// the views are filled in when the pass is executed, imported images may have changed
+		std::vector<resource_handle> color_images;
+		std::vector<command_buffer::rendering_attachment> color_attachments;
+		std::vector<VkFormat> color_formats;
+		resource_handle depth_image = INVALID_RESOURCE;
+		command_buffer::rendering_attachment depth_attachment{};
+		VkFormat depth_format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent{};
+	};
+
+	void cull_passes();
+	void compute_lifetimes();
+	bool create_transient_images();
+	void compute_barriers();
+	void prepare_attachments();
+	void record_barriers(command_buffer& cmd_buf, const barrier_batch& barriers);
+	uint32_t index_of(const pass& p) const;
+
+	std::vector<resource> m_resources;
+	std::deque<pass> m_passes;
+	std::vector<compiled_pass> m_compiled;
+	std::vector<memory_slot> m_memory_slots;
+	barrier_batch m_final_barriers; // transitions of imported images into their final layout
+	std::vector<VkImageMemoryBarrier> m_barrier_scratch;
+	bool m_compiled_graph = false;
+	statistics m_statistics{};
+};
+
+#endif //ENGINE_RENDERER_RENDER_GRAPH_H
@@ -1,6 +1,7 @@
 #include "renderpass.h"
 #include "context.h"
 #include <assert.h>
+#include <string.h>
 
 static void make_present_attachment(VkAttachmentDescription& descr, const render_pass_builder::attachment_description& attachment_descr) {
 	descr.flags = 0;
@@ -11,7 +12,8 @@ static void make_present_attachment(VkAttachmentDescription& descr, const render
 	descr.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	descr.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	descr.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	descr.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// offscreen images are read back instead of presented
+	descr.finalLayout = context::is_headless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 }
 
 /*
@@ -28,6 +30,25 @@ static VkAttachmentReference* append_reference(const VkAttachmentReference* refe
 	return new_references;
 }
 
+static void make_attachment(VkAttachmentDescription& descr, const render_pass_builder::attachment_description& attachment_descr, VkImageLayout attachment_layout) {
+	descr.flags = 0;
+	descr.format = attachment_descr.format;
+	descr.samples = (VkSampleCountFlagBits)attachment_descr.samples;
+	descr.loadOp = attachment_descr.load_op;
+	descr.storeOp = attachment_descr.store_op;
+	bool has_stencil = has_stencil_component(attachment_descr.format);
+	descr.stencilLoadOp = has_stencil ? attachment_descr.load_op : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	descr.stencilStoreOp = has_stencil ? attachment_descr.store_op : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	// the old contents are only needed when they are loaded
+	if (attachment_descr.initial_layout != VK_IMAGE_LAYOUT_UNDEFINED)
+		descr.initialLayout = attachment_descr.initial_layout;
+	else if (descr.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD || descr.stencilLoadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+		descr.initialLayout = attachment_layout;
+	else
+		descr.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	descr.finalLayout = attachment_descr.final_layout != VK_IMAGE_LAYOUT_UNDEFINED ? attachment_descr.final_layout : attachment_layout;
+}
+
 uint32_t render_pass_builder::add_attachment(const attachment_description& attachment_descr) {
 	uint32_t attachment_location = (uint32_t) m_attachments.size();
 	VkAttachmentDescription& descr = m_attachments.emplace_back();
@@ -36,27 +57,40 @@ uint32_t render_pass_builder::add_attachment(const attachment_description& attac
 
 	if (attachment_descr.type == attachment_type::PRESENT_ATTACHMENT)
 		make_present_attachment(descr, attachment_descr);
+	else if (attachment_descr.type == attachment_type::COLOR_ATTACHMENT)
+		make_attachment(descr, attachment_descr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 	else
-		assert(0 && "currently unsupported attachment type");
+		make_attachment(descr, attachment_descr, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 	return attachment_location;
 }
 
 VkRenderPass render_pass_builder::build() {
-
-
-	VkAttachmentReference color_attachment_ref;
-	color_attachment_ref.attachment = 0;
-	color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkSubpassDependency dependency = {};
+	assert(!m_subpasses.empty() && "a render pass needs a subpass");
+	std::vector<VkSubpassDependency> dependencies(m_subpasses.size());
+	VkSubpassDependency& dependency = dependencies[0];
 	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	dependency.dependencyFlags = 0;
 
+	// every subpass waits for the attachment writes of the one before it. Only the same pixel is read, e.g. the
+	// depth of a pre-pass or an input attachment, so the dependencies are by region
+	for (uint32_t subpass = 1; subpass < (uint32_t)m_subpasses.size(); subpass++) {
+		VkSubpassDependency& d = dependencies[subpass];
+		d.srcSubpass = subpass - 1;
+		d.dstSubpass = subpass;
+		d.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		d.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		d.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+			| VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		d.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+			| VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		d.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+	}
+
 
 	VkRenderPassCreateInfo create_info = { };
 	create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -66,8 +100,8 @@ VkRenderPass render_pass_builder::build() {
 	create_info.pAttachments = m_attachments.data();
 	create_info.subpassCount = (uint32_t)m_subpasses.size();
 	create_info.pSubpasses = m_subpasses.data();
-	create_info.dependencyCount = 1;
-	create_info.pDependencies = &dependency;
+	create_info.dependencyCount = (uint32_t)dependencies.size();
+	create_info.pDependencies = dependencies.data();
 
 
 	VkRenderPass render_pass;
@@ -89,6 +123,31 @@ void render_pass_builder::write_color_attachment(uint32_t location) {
 }
 
 
+void render_pass_builder::write_depth_stencil_attachment(uint32_t location) {
+	set_depth_stencil_reference(location, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+}
+
+void render_pass_builder::read_depth_stencil_attachment(uint32_t location) {
+	set_depth_stencil_reference(location, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+}
+
+void render_pass_builder::set_depth_stencil_reference(uint32_t location, VkImageLayout layout) {
+	VkSubpassDescription& descr = current_subpass();
+	assert(descr.pDepthStencilAttachment == NULL && "a subpass has only one depth stencil attachment");
+
+	VkAttachmentReference* reference = new VkAttachmentReference;
+	reference->layout = layout;
+	reference->attachment = location;
+	descr.pDepthStencilAttachment = reference;
+}
+
+void render_pass_builder::add_depth_prepass(uint32_t depth_location) {
+	assert(m_subpasses.empty() && "the depth pre-pass is the first subpass");
+	begin_subpass();
+	write_depth_stencil_attachment(depth_location);
+	end_subpass();
+}
+
 void render_pass_builder::use_input_attachment(uint32_t location) {
 	VkSubpassDescription& descr = current_subpass();
 	VkAttachmentReference reference;
@@ -104,7 +163,7 @@ void render_pass_builder::use_input_attachment(uint32_t location) {
 }
 
 void render_pass_builder::begin_subpass() {
-	VkSubpassDescription descr = m_subpasses.emplace_back();
+	VkSubpassDescription& descr = m_subpasses.emplace_back();
 	descr.flags = 0;
 	descr.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	descr.inputAttachmentCount = 0;
@@ -121,6 +180,7 @@ void render_pass_builder::begin_subpass() {
 
 render_pass_builder::~render_pass_builder() {
 	for (VkSubpassDescription& subpass : m_subpasses) {
+		delete[] subpass.pInputAttachments;
 		delete[] subpass.pColorAttachments;
 		delete[] subpass.pResolveAttachments;
 		delete[] subpass.pPreserveAttachments;
@@ -129,11 +189,33 @@ render_pass_builder::~render_pass_builder() {
 }
 
 void render_pass_builder::end_subpass() {
-	// I think all unused attachments can be added to the pPreserve attachments of the subpass
-	// I should look into this at some point
 	generate_preserve_attachment_references();
 }
 
-void render_pass_builder::generate_preserve_attachment_references() {
+static bool references(const VkAttachmentReference* refs, uint32_t count, uint32_t location) {
+	for (uint32_t i = 0; i < count; i++) {
+		if (refs[i].attachment == location)
+			return true;
+	}
+	return false;
+}
 
+// the contents of attachments a subpass does not use are only kept if they are preserved.
+// Every attachment that is added before the subpass ends and is not referenced by it is preserved
+void render_pass_builder::generate_preserve_attachment_references() {
+	VkSubpassDescription& descr = current_subpass();
+	uint32_t* preserved = new uint32_t[m_attachments.size() + 1];
+	uint32_t count = 0;
+	for (uint32_t location = 0; location < (uint32_t)m_attachments.size(); location++) {
+		if (references(descr.pColorAttachments, descr.colorAttachmentCount, location)
+			|| references(descr.pInputAttachments, descr.inputAttachmentCount, location)
+			|| references(descr.pDepthStencilAttachment, descr.pDepthStencilAttachment != NULL, location))
+			continue;
+		preserved[count++] = location;
+	}
+	delete[] descr.pPreserveAttachments;
+	descr.pPreserveAttachments = count > 0 ? preserved : NULL;
+	descr.preserveAttachmentCount = count;
+	if (count == 0)
+		delete[] preserved;
 }
\ No newline at end of file
@@ -18,6 +18,16 @@ public:
 		attachment_description(attachment_type a_type, int samples) : samples(samples), type(a_type) {}
 		attachment_type type;
 		int samples;
+
+		// color and depth stencil attachments only. The present attachment uses the surface format
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		VkAttachmentStoreOp store_op = VK_ATTACHMENT_STORE_OP_STORE;
+		// the attachment layout is used if they are left undefined. Attachments that are cleared or not loaded
+		// start from VK_IMAGE_LAYOUT_UNDEFINED instead, so no barrier has to establish a layout for them.
+		// Loaded attachments have to be in their initial layout before the render pass begins
+		VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 	};
 
 
@@ -27,15 +37,25 @@ public:
 	void begin_subpass();
 	
 	void write_color_attachment(uint32_t location);
+	// a subpass has at most one depth stencil attachment
+	void write_depth_stencil_attachment(uint32_t location);
+	// depth and stencil tests without writes
+	void read_depth_stencil_attachment(uint32_t location);
 	void use_input_attachment(uint32_t location);
 
 	void end_subpass();
+
+	// adds a subpass that only writes depth. It has to be the first subpass, the subpasses that follow it
+	// shade with read_depth_stencil_attachment and pipelines that test with VK_COMPARE_OP_EQUAL.
+	// Its pipelines are built with pipeline_builder::set_depth_only and set_subpass(0)
+	void add_depth_prepass(uint32_t depth_location);
 private:
 	inline VkSubpassDescription& current_subpass() { return m_subpasses.back(); }
 	std::vector<VkAttachmentDescription> m_attachments;
 	std::vector<VkSubpassDescription> m_subpasses;
 
 	void generate_preserve_attachment_references();
+	void set_depth_stencil_reference(uint32_t location, VkImageLayout layout);
 
 
 
@@ -1,6 +1,24 @@
 #include "shader.h"
 #include "context.h"
 #include <stdio.h>
+#include <unordered_map>
+#include <mutex>
+
+// handles can be reused by the driver after a module was destroyed, so destroy_module erases the entry.
+// Pipelines are built on worker threads, so the table is locked
+static std::unordered_map<VkShaderModule, uint64_t> s_code_hashes;
+static std::mutex s_code_hashes_mutex;
+
+// FNV-1a
+static uint64_t hash_code(const void* data, uint32_t size) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
 
 VkShaderModule shader::load_module_from_file(const char* filepath) {
 
@@ -40,7 +58,26 @@ VkShaderModule shader::load_module(const void* data, uint32_t size) {
 	create_info.pCode = (uint32_t*)data;
 
 	VkShaderModule shader_module;
-	if(vkCreateShaderModule(context::get_device(), &create_info, NULL, &shader_module) == VK_SUCCESS)
-		return shader_module;
-	return VK_NULL_HANDLE;
+	if (vkCreateShaderModule(context::get_device(), &create_info, NULL, &shader_module) != VK_SUCCESS)
+		return VK_NULL_HANDLE;
+	uint64_t hash = hash_code(data, size);
+	std::lock_guard<std::mutex> lock(s_code_hashes_mutex);
+	s_code_hashes[shader_module] = hash;
+	return shader_module;
+}
+
+uint64_t shader::get_code_hash(VkShaderModule shader_module) {
+	std::lock_guard<std::mutex> lock(s_code_hashes_mutex);
+	auto it = s_code_hashes.find(shader_module);
+	return it != s_code_hashes.end() ? it->second : 0;
+}
+
+void shader::destroy_module(VkShaderModule shader_module) {
+	if (shader_module == VK_NULL_HANDLE)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(s_code_hashes_mutex);
+		s_code_hashes.erase(shader_module);
+	}
+	vkDestroyShaderModule(context::get_device(), shader_module, NULL);
 }
\ No newline at end of file
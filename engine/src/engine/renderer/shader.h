@@ -2,11 +2,18 @@
 #define ENGINE_RENDERER_SHADER_H
 
 #include <vulkan/vulkan.h>
+#include <stdint.h>
 
 class shader {
 public:
 	static VkShaderModule load_module_from_file(const char* filepath);
 	static VkShaderModule load_module(const void* data, uint32_t size);
+	// forgets the code hash before the handle can be reused by the driver
+	static void destroy_module(VkShaderModule shader_module);
+
+	// hash of the SPIR-V code the module was created from. Modules with the same code have the same hash,
+	// which lets pipelines be shared even if the module was loaded twice. 0 for unknown and destroyed modules
+	static uint64_t get_code_hash(VkShaderModule shader_module);
 
 };
 
@@ -0,0 +1,93 @@
+#include "submit_batch.h"
+#include "context.h"
+
+void submit_batch::begin_submission() {
+	submission& sub = m_submissions.emplace_back();
+	sub.first_wait = (uint32_t)m_waits.size();
+	sub.wait_count = 0;
+	sub.first_command_buffer = (uint32_t)m_command_buffers.size();
+	sub.command_buffer_count = 0;
+	sub.first_signal = (uint32_t)m_signals.size();
+	sub.signal_count = 0;
+}
+
+submit_batch::submission& submit_batch::current() {
+	if (m_submissions.empty())
+		begin_submission();
+	return m_submissions.back();
+}
+
+void submit_batch::add_wait(VkSemaphore semaphore, VkPipelineStageFlags stages, uint64_t value) {
+	if (semaphore == VK_NULL_HANDLE)
+		return;
+	current().wait_count++;
+	m_waits.push_back(semaphore);
+	m_wait_stages.push_back(stages);
+	m_wait_values.push_back(value);
+}
+
+void submit_batch::add_command_buffer(VkCommandBuffer cmd_buf) {
+	current().command_buffer_count++;
+	m_command_buffers.push_back(cmd_buf);
+}
+
+void submit_batch::add_signal(VkSemaphore semaphore, uint64_t value) {
+	if (semaphore == VK_NULL_HANDLE)
+		return;
+	current().signal_count++;
+	m_signals.push_back(semaphore);
+	m_signal_values.push_back(value);
+}
+
+void submit_batch::add(VkCommandBuffer cmd_buf, VkSemaphore wait, VkPipelineStageFlags wait_stages, VkSemaphore signal) {
+	begin_submission();
+	add_wait(wait, wait_stages);
+	add_command_buffer(cmd_buf);
+	add_signal(signal);
+}
+
+VkResult submit_batch::flush(VkFence fence) {
+	if (m_submissions.empty() && fence == VK_NULL_HANDLE)
+		return VK_SUCCESS;
+
+	m_submit_infos.resize(m_submissions.size());
+	m_timeline_infos.resize(m_submissions.size());
+	for (size_t i = 0; i < m_submissions.size(); i++) {
+		const submission& sub = m_submissions[i];
+		// binary semaphores ignore their values, so every submission can carry them
+		VkTimelineSemaphoreSubmitInfo& timeline_info = m_timeline_infos[i];
+		timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timeline_info.pNext = NULL;
+		timeline_info.waitSemaphoreValueCount = sub.wait_count;
+		timeline_info.pWaitSemaphoreValues = m_wait_values.data() + sub.first_wait;
+		timeline_info.signalSemaphoreValueCount = sub.signal_count;
+		timeline_info.pSignalSemaphoreValues = m_signal_values.data() + sub.first_signal;
+
+		VkSubmitInfo& info = m_submit_infos[i];
+		info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		info.pNext = &timeline_info;
+		info.waitSemaphoreCount = sub.wait_count;
+		info.pWaitSemaphores = m_waits.data() + sub.first_wait;
+		info.pWaitDstStageMask = m_wait_stages.data() + sub.first_wait;
+		info.commandBufferCount = sub.command_buffer_count;
+		info.pCommandBuffers = m_command_buffers.data() + sub.first_command_buffer;
+		info.signalSemaphoreCount = sub.signal_count;
+		info.pSignalSemaphores = m_signals.data() + sub.first_signal;
+	}
+
+	// host writes to mapped memory have to be visible before the device reads them
+	context::get_memory_allocator().flush_mapped_ranges();
+	VkResult result = vkQueueSubmit(m_queue, (uint32_t)m_submit_infos.size(), m_submit_infos.data(), fence);
+	clear();
+	return result;
+}
+
+void submit_batch::clear() {
+	m_submissions.clear();
+	m_waits.clear();
+	m_wait_stages.clear();
+	m_wait_values.clear();
+	m_command_buffers.clear();
+	m_signals.clear();
+	m_signal_values.clear();
+}
@@ -0,0 +1,62 @@
+#ifndef ENGINE_RENDERER_SUBMIT_BATCH_H
+#define ENGINE_RENDERER_SUBMIT_BATCH_H
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+/*
+* Collects the submissions for one queue and hands them to the driver with a single vkQueueSubmit.
+* Every submission keeps its own wait semaphores, stage masks and signal semaphores,
+* so batching does not change the dependencies between them. They start in the order they were added.
+*/
+class submit_batch {
+public:
+	submit_batch() = default;
+	explicit submit_batch(VkQueue queue) : m_queue(queue) {}
+
+	void set_queue(VkQueue queue) { m_queue = queue; }
+	VkQueue get_queue() const { return m_queue; }
+
+	// starts a new submission. Waits, command buffers and signals that are added afterwards belong to it
+	void begin_submission();
+	// the commands of the submission wait for the semaphore in the given stages. NULL semaphores are ignored.
+	// The value is only used for timeline semaphores
+	void add_wait(VkSemaphore semaphore, VkPipelineStageFlags stages, uint64_t value = 0);
+	void add_command_buffer(VkCommandBuffer cmd_buf);
+	// NULL semaphores are ignored. The value is only used for timeline semaphores
+	void add_signal(VkSemaphore semaphore, uint64_t value = 0);
+
+	// one submission with a single command buffer
+	void add(VkCommandBuffer cmd_buf, VkSemaphore wait = VK_NULL_HANDLE, VkPipelineStageFlags wait_stages = 0, VkSemaphore signal = VK_NULL_HANDLE);
+
+	bool empty() const { return m_submissions.empty(); }
+	size_t submission_count() const { return m_submissions.size(); }
+
+	// submits everything that was added since the last flush with one vkQueueSubmit.
+	// The fence signals once all submissions have finished. It is signaled even if the batch is empty
+	VkResult flush(VkFence fence = VK_NULL_HANDLE);
+	// drops everything without submitting
+	void clear();
+
+private:
+	// ranges into the arrays below. They only become pointers in flush, so the arrays can grow
+	struct submission {
+		uint32_t first_wait, wait_count;
+		uint32_t first_command_buffer, command_buffer_count;
+		uint32_t first_signal, signal_count;
+	};
+	submission& current();
+
+	VkQueue m_queue = VK_NULL_HANDLE;
+	std::vector<submission> m_submissions;
+	std::vector<VkSemaphore> m_waits;
+	std::vector<VkPipelineStageFlags> m_wait_stages;
+	std::vector<uint64_t> m_wait_values;
+	std::vector<VkCommandBuffer> m_command_buffers;
+	std::vector<VkSemaphore> m_signals;
+	std::vector<uint64_t> m_signal_values;
+	std::vector<VkSubmitInfo> m_submit_infos;
+	std::vector<VkTimelineSemaphoreSubmitInfo> m_timeline_infos;
+};
+
+#endif //ENGINE_RENDERER_SUBMIT_BATCH_H
@@ -0,0 +1,257 @@
+#include "tlsf.h"
+#include <assert.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// index of the lowest set bit. value must not be 0
+static uint32_t find_first_set(uint64_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (uint32_t)index;
+#else
+	return (uint32_t)__builtin_ctzll(value);
+#endif
+}
+
+// index of the highest set bit. value must not be 0
+static uint32_t find_last_set(uint64_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (uint32_t)index;
+#else
+	return 63 - (uint32_t)__builtin_clzll(value);
+#endif
+}
+
+
+void tlsf::initialize(VkDeviceSize capacity) {
+	destroy();
+	m_capacity = capacity;
+
+	block* b = create_node();
+	b->offset = 0;
+	b->size = capacity;
+	b->prev_physical = NULL;
+	b->next_physical = NULL;
+	m_first = b;
+	insert_free_block(b);
+}
+
+void tlsf::destroy() {
+	for (block* chunk : m_node_chunks)
+		delete[] chunk;
+	m_node_chunks.clear();
+	m_unused_nodes = NULL;
+	m_first = NULL;
+	m_capacity = 0;
+	m_allocation_count = 0;
+
+	m_fl_bitmap = 0;
+	for (uint32_t fl = 0; fl < FL_COUNT; fl++) {
+		m_sl_bitmap[fl] = 0;
+		for (uint32_t sl = 0; sl < SL_COUNT; sl++)
+			m_free_lists[fl][sl] = NULL;
+	}
+}
+
+// small sizes get one class per size. Larger sizes split every power of two into SL_COUNT classes
+void tlsf::mapping_insert(VkDeviceSize size, uint32_t* fl, uint32_t* sl) {
+	if (size < SL_COUNT) {
+		*fl = 0;
+		*sl = (uint32_t)size;
+		return;
+	}
+	uint32_t msb = find_last_set(size);
+	*sl = (uint32_t)(size >> (msb - SL_LOG2)) ^ SL_COUNT;
+	*fl = msb - SL_LOG2 + 1;
+}
+
+// rounds the size up to the next class so every block in that class is large enough
+void tlsf::mapping_search(VkDeviceSize size, uint32_t* fl, uint32_t* sl) {
+	if (size >= SL_COUNT) {
+		uint32_t msb = find_last_set(size);
+		size += (1ull << (msb - SL_LOG2)) - 1;
+	}
+	mapping_insert(size, fl, sl);
+}
+
+VkDeviceSize tlsf::required_capacity(VkDeviceSize size, VkDeviceSize alignment) {
+	if (alignment == 0)
+		alignment = 1;
+	// the smallest size of the class allocate searches in
+	VkDeviceSize search_size = size + alignment - 1;
+	if (search_size < SL_COUNT)
+		return search_size;
+	uint32_t msb = find_last_set(search_size);
+	search_size += (1ull << (msb - SL_LOG2)) - 1;
+	msb = find_last_set(search_size);
+	return search_size & ~((1ull << (msb - SL_LOG2)) - 1);
+}
+
+tlsf::block* tlsf::find_free_block(uint32_t* fl, uint32_t* sl) const {
+	if (*fl >= FL_COUNT)
+		return NULL;
+
+	uint32_t sl_map = m_sl_bitmap[*fl] & (~0u << *sl);
+	if (sl_map == 0) {
+		// nothing left in this first level. Take the smallest larger one
+		uint64_t fl_map = *fl + 1 < 64 ? m_fl_bitmap & (~0ull << (*fl + 1)) : 0;
+		if (fl_map == 0)
+			return NULL;
+		*fl = find_first_set(fl_map);
+		sl_map = m_sl_bitmap[*fl];
+		assert(sl_map != 0);
+	}
+	*sl = find_first_set(sl_map);
+	return m_free_lists[*fl][*sl];
+}
+
+void tlsf::insert_free_block(block* b) {
+	uint32_t fl, sl;
+	mapping_insert(b->size, &fl, &sl);
+
+	block* head = m_free_lists[fl][sl];
+	b->free = true;
+	b->prev_free = NULL;
+	b->next_free = head;
+	if (head)
+		head->prev_free = b;
+	m_free_lists[fl][sl] = b;
+
+	m_fl_bitmap |= 1ull << fl;
+	m_sl_bitmap[fl] |= 1u << sl;
+}
+
+void tlsf::remove_free_block(block* b) {
+	uint32_t fl, sl;
+	mapping_insert(b->size, &fl, &sl);
+	remove_free_block(b, fl, sl);
+}
+
+void tlsf::remove_free_block(block* b, uint32_t fl, uint32_t sl) {
+	if (b->prev_free)
+		b->prev_free->next_free = b->next_free;
+	if (b->next_free)
+		b->next_free->prev_free = b->prev_free;
+
+	if (m_free_lists[fl][sl] == b) {
+		m_free_lists[fl][sl] = b->next_free;
+		if (b->next_free == NULL) {
+			m_sl_bitmap[fl] &= ~(1u << sl);
+			if (m_sl_bitmap[fl] == 0)
+				m_fl_bitmap &= ~(1ull << fl);
+		}
+	}
+	b->prev_free = NULL;
+	b->next_free = NULL;
+	b->free = false;
+}
+
+tlsf::block_handle tlsf::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+	assert(is_initialized());
+	if (alignment == 0)
+		alignment = 1;
+	if (size == 0 || size > m_capacity)
+		return NULL;
+
+	// search for a block that fits the allocation even in the worst case of padding
+	VkDeviceSize search_size = size + alignment - 1;
+	uint32_t fl, sl;
+	mapping_search(search_size, &fl, &sl);
+	block* b = find_free_block(&fl, &sl);
+	if (b == NULL)
+		return NULL;
+	remove_free_block(b, fl, sl);
+	assert(b->size >= search_size);
+
+	// the padding in front of the aligned offset stays free.
+	// The previous block is never free because free neighbours are always merged
+	VkDeviceSize padding = (alignment - b->offset % alignment) % alignment;
+	if (padding > 0) {
+		block* front = b;
+		b = split_front(front, padding);
+		insert_free_block(front);
+	}
+
+	// give the remainder back to the free lists
+	if (b->size > size) {
+		block* remainder = split_front(b, size);
+		insert_free_block(remainder);
+	}
+
+	assert(b->offset % alignment == 0);
+	b->free = false;
+	m_allocation_count++;
+	return b;
+}
+
+// shrinks the block to the given size and returns a new block for the rest of the range
+tlsf::block* tlsf::split_front(block* b, VkDeviceSize size) {
+	assert(b->size > size);
+	block* rest = create_node();
+	rest->offset = b->offset + size;
+	rest->size = b->size - size;
+	rest->prev_physical = b;
+	rest->next_physical = b->next_physical;
+	if (b->next_physical)
+		b->next_physical->prev_physical = rest;
+	b->next_physical = rest;
+	b->size = size;
+	return rest;
+}
+
+void tlsf::free(block_handle b) {
+	if (b == NULL)
+		return;
+	assert(!b->free);
+	m_allocation_count--;
+
+	// merge with the previous block
+	block* prev = b->prev_physical;
+	if (prev && prev->free) {
+		remove_free_block(prev);
+		prev->size += b->size;
+		prev->next_physical = b->next_physical;
+		if (b->next_physical)
+			b->next_physical->prev_physical = prev;
+		release_node(b);
+		b = prev;
+	}
+
+	// merge with the next block
+	block* next = b->next_physical;
+	if (next && next->free) {
+		remove_free_block(next);
+		b->size += next->size;
+		b->next_physical = next->next_physical;
+		if (next->next_physical)
+			next->next_physical->prev_physical = b;
+		release_node(next);
+	}
+
+	insert_free_block(b);
+}
+
+tlsf::block* tlsf::create_node() {
+	if (m_unused_nodes == NULL) {
+		block* chunk = new block[NODES_PER_CHUNK];
+		m_node_chunks.push_back(chunk);
+		for (uint32_t i = 0; i < NODES_PER_CHUNK; i++)
+			release_node(&chunk[i]);
+	}
+	block* b = m_unused_nodes;
+	m_unused_nodes = b->next_free;
+	b->prev_free = NULL;
+	b->next_free = NULL;
+	b->free = false;
+	return b;
+}
+
+void tlsf::release_node(block* b) {
+	b->next_free = m_unused_nodes;
+	m_unused_nodes = b;
+}
@@ -0,0 +1,106 @@
+#ifndef ENGINE_RENDERER_TLSF_H
+#define ENGINE_RENDERER_TLSF_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+* Two level segregated fit allocator.
+* It only hands out offsets into a range [0, capacity) and never touches the memory itself,
+* so it works for device memory that is not host visible.
+* Free ranges are kept in size classes which are found through two bitmaps.
+* This makes allocate and free O(1). Neighbouring free ranges are merged on free.
+*/
+class tlsf {
+public:
+	struct block;
+	using block_handle = block*;
+
+	tlsf() = default;
+	~tlsf() { destroy(); }
+	tlsf(const tlsf&) = delete;
+	tlsf& operator=(const tlsf&) = delete;
+
+	void initialize(VkDeviceSize capacity);
+	void destroy();
+
+	// returns NULL if there is no free range that is large enough.
+	// The returned offset is a multiple of alignment
+	block_handle allocate(VkDeviceSize size, VkDeviceSize alignment = 1);
+	void free(block_handle block);
+
+	static VkDeviceSize offset(block_handle block);
+	static VkDeviceSize size(block_handle block);
+	// the capacity an empty allocator needs for allocate(size, alignment) to succeed.
+	// Free ranges are searched by size class, so this is more than size
+	static VkDeviceSize required_capacity(VkDeviceSize size, VkDeviceSize alignment = 1);
+
+	inline bool is_initialized() const { return m_first != NULL; }
+	inline bool empty() const { return m_allocation_count == 0; }
+	inline size_t allocation_count() const { return m_allocation_count; }
+	inline VkDeviceSize capacity() const { return m_capacity; }
+
+	// calls f(offset, size) for every live allocation in address order
+	template<typename F>
+	void for_each_allocation(F f) const;
+
+private:
+	static constexpr uint32_t SL_LOG2 = 5;
+	static constexpr uint32_t SL_COUNT = 1 << SL_LOG2;
+	static constexpr uint32_t FL_COUNT = 64 - SL_LOG2 + 1;
+	static constexpr uint32_t NODES_PER_CHUNK = 256;
+
+	static void mapping_insert(VkDeviceSize size, uint32_t* fl, uint32_t* sl);
+	static void mapping_search(VkDeviceSize size, uint32_t* fl, uint32_t* sl);
+	block* find_free_block(uint32_t* fl, uint32_t* sl) const;
+
+	block* split_front(block* block, VkDeviceSize size);
+	void insert_free_block(block* block);
+	void remove_free_block(block* block);
+	void remove_free_block(block* block, uint32_t fl, uint32_t sl);
+
+	block* create_node();
+	void release_node(block* block);
+
+	VkDeviceSize m_capacity = 0;
+	size_t m_allocation_count = 0;
+
+	uint64_t m_fl_bitmap = 0;
+	uint32_t m_sl_bitmap[FL_COUNT] = {};
+	block* m_free_lists[FL_COUNT][SL_COUNT] = {};
+
+	// lowest block in memory. Used to walk all blocks in address order
+	block* m_first = NULL;
+
+	// block nodes are recycled so allocating does not hit the heap
+	std::vector<block*> m_node_chunks;
+	block* m_unused_nodes = NULL;
+};
+
+struct tlsf::block {
+	VkDeviceSize offset;
+	VkDeviceSize size;
+
+	block* prev_physical;
+	block* next_physical;
+
+	// only valid while the block is free
+	block* prev_free;
+	block* next_free;
+
+	bool free;
+};
+
+inline VkDeviceSize tlsf::offset(block_handle block) { return block->offset; }
+inline VkDeviceSize tlsf::size(block_handle block) { return block->size; }
+
+template<typename F>
+void tlsf::for_each_allocation(F f) const {
+	for (const block* b = m_first; b != NULL; b = b->next_physical) {
+		if (!b->free)
+			f(b->offset, b->size);
+	}
+}
+
+#endif //ENGINE_RENDERER_TLSF_H
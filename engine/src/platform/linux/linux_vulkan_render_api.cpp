@@ -0,0 +1,17 @@
+#include "engine/renderer/render_api.h"
+#include "engine/renderer/context.h"
+#include "vulkan/vulkan.h"
+
+
+// there is no display server. The context renders into offscreen images of the size of the window
+bool context::create_surface(window_handle_t handle) {
+	const window* headless_window = (const window*)handle;
+	if (headless_window == NULL)
+		return false;
+
+	m_surface.surface = VK_NULL_HANDLE;
+	m_surface.surface_format = { VK_FORMAT_R8G8B8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+	m_offscreen_extent.width = (uint32_t)headless_window->get_width();
+	m_offscreen_extent.height = (uint32_t)headless_window->get_height();
+	return true;
+}
@@ -0,0 +1,23 @@
+#include "engine/core/window.h"
+
+// headless window. There is no display, so it only remembers its size and never receives events.
+// The handle points to the window itself, which lets the context read the size for its offscreen images
+
+window::window(const char* title, int width, int height) : m_width(width), m_height(height), m_window_handle(0), m_close_requested(false), m_closed(false) {
+	m_window_handle = (window_handle_t)this;
+}
+
+bool window::is_minimized() const {
+	return false;
+}
+
+void window::poll_events() {
+}
+
+void window::wait_events() {
+}
+
+void window::destroy() {
+	m_window_handle = 0;
+	m_closed = true;
+}
@@ -2,7 +2,7 @@
 workspace "Vulkan rendering"
 	configurations { "Debug", "Release", "Distribution"}
 	architecture "x86_64"
-	platforms {"WINDOWS"}
+	platforms {"WINDOWS", "LINUX"}
 
 
 
@@ -31,6 +31,13 @@ project "sandbox"
 		"engine"
 	}
 	
+	filter "platforms:WINDOWS"
+		defines {"PLATFORM_WINDOWS"}
+
+	filter "platforms:LINUX"
+		defines {"PLATFORM_LINUX"}
+		links {"vulkan", "pthread"}
+
 
 
 	filter "configurations:Debug"
@@ -48,6 +55,46 @@ project "sandbox"
 		staticruntime "Off"
 
 
+-- cpu only. Times the tlsf sub-allocator against the old linear scan, no device is created
+project "benchmark"
+	kind "ConsoleApp"
+	language "C++"
+	location "benchmark"
+	targetdir "bin/%{cfg.buildcfg}"
+	cppdialect "C++17"
+
+	files {
+		"benchmark/src/**.cpp",
+		"engine/src/engine/renderer/tlsf.cpp",
+		"engine/src/engine/renderer/tlsf.h"
+	}
+
+	includedirs {
+		"engine/src",
+		"$(VULKAN_SDK)/include"
+	}
+
+	filter "platforms:WINDOWS"
+		defines {"PLATFORM_WINDOWS"}
+
+	filter "platforms:LINUX"
+		defines {"PLATFORM_LINUX"}
+
+	filter "configurations:Debug"
+		defines {"DEBUG"}
+		symbols "On"
+
+	filter "configurations:Release"
+		defines {"RELEASE", "NDEBUG" }
+		optimize "On"
+		staticruntime "Off"
+		
+	filter "configurations:Distribution"
+		defines {"DISTRIBUTION", "NDEBUG" }
+		optimize "On"
+		staticruntime "Off"
+
+
 project "engine"
 	kind "StaticLib"
 	language "C++"
@@ -67,20 +114,24 @@ project "engine"
 		"engine/src",
 		"$(VULKAN_SDK)/include"
 	}
-	libdirs {
-		"$(VULKAN_SDK)/Lib"
-	}
-
-	links {
-		"vulkan-1.lib",
-		"VkLayer_utils.lib"
-	}
-
 	defines {"BUILD_ENGINE"}
 
 	filter "platforms:WINDOWS"
 		defines {"PLATFORM_WINDOWS"}
-		files {"engine/src/platform/windows"}
+		removefiles {"engine/src/platform/linux/**"}
+		libdirs {
+			"$(VULKAN_SDK)/Lib"
+		}
+		links {
+			"vulkan-1.lib",
+			"VkLayer_utils.lib"
+		}
+
+	-- headless: no window and no display server. Renders into offscreen images
+	filter "platforms:LINUX"
+		defines {"PLATFORM_LINUX"}
+		removefiles {"engine/src/platform/windows/**"}
+		links {"vulkan"}
 
 	filter "configurations:Debug"
 		defines {"DEBUG"}
@@ -0,0 +1,61 @@
+#version 450
+
+// frustum culling. Every invocation tests one object and appends a draw command for it if it is visible.
+// The layout of the buffers matches culling_pass::object and indirect_buffer
+
+layout(local_size_x = 64) in;
+
+struct object {
+    vec4 sphere; // world space center and radius
+    uint index_count;
+    uint first_index;
+    int vertex_offset;
+    uint padding;
+};
+
+struct draw_command {
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int vertex_offset;
+    uint first_instance;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer object_buffer {
+    object objects[];
+};
+
+layout(std430, set = 0, binding = 1) buffer draw_buffer {
+    uint draw_count;
+    uint padding[3];
+    draw_command draws[];
+};
+
+// object index of every draw command. Vertex shaders read it with gl_DrawID if the first instance is always 0
+layout(std430, set = 0, binding = 2) writeonly buffer draw_object_buffer {
+    uint draw_objects[];
+};
+
+layout(push_constant) uniform cull_constants {
+    vec4 planes[6]; // xyz normal pointing inwards, w distance
+    uint object_count;
+    uint use_first_instance; // 0 without the drawIndirectFirstInstance feature
+} constants;
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= constants.object_count)
+        return;
+
+    object o = objects[index];
+    for (int i = 0; i < 6; i++) {
+        if (dot(constants.planes[i].xyz, o.sphere.xyz) + constants.planes[i].w < -o.sphere.w)
+            return;
+    }
+
+    // the object index is passed as the instance, so per object data can be read from an instance buffer
+    uint slot = atomicAdd(draw_count, 1);
+    uint first_instance = constants.use_first_instance != 0 ? index : 0;
+    draws[slot] = draw_command(o.index_count, 1, o.first_index, o.vertex_offset, first_instance);
+    draw_objects[slot] = index;
+}
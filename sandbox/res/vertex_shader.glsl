@@ -9,6 +9,8 @@ layout(push_constant) uniform camera_object{
 }camera;
 
 layout(location = 0) out vec3 f_world_pos;
+// the depth pre-pass and the main pass run this shader in different pipelines
+invariant gl_Position;
 
 
 void main() {
@@ -7,38 +7,65 @@
 #include "engine/core/entrypoint.h"
 
 class sandbox_app : public application {
+public:
+	sandbox_app() {
+#ifdef PLATFORM_LINUX
+		// headless runs are benchmarks. They end after a fixed number of frames and keep the last image
+		m_frame_limit = 1000;
+#endif
+	}
+private:
 
 	bool on_create() override {
-		// create the renderpass
-		render_pass_builder render_pass_builder;
-		uint32_t output_location = render_pass_builder.add_attachment(render_pass_builder::attachment_description{ render_pass_builder::attachment_type::PRESENT_ATTACHMENT });
-		render_pass_builder.begin_subpass();
-		render_pass_builder.write_color_attachment(output_location);
-		render_pass_builder.end_subpass();
-
-		m_render_pass = render_pass_builder.build();
+		// the frame renders with dynamic rendering, so there is no render pass
+		VkFormat color_format = context::get_surface().surface_format.format;
 
+		m_depth_buffer_format = find_depth_format();
+		if (m_depth_buffer_format == VK_FORMAT_UNDEFINED)
+			return false;
 
-		struct p_constant {
-			glm::mat4 view_projection_matrix;
-			glm::mat4 model_matrix;
-		};
-
-		// create the graphics pipeline
-		pipeline_builder pipeline_builder{ m_render_pass };
-		pipeline_builder.buffer_layout_push_floats(3);
+		// create the graphics pipelines. They work with every attachment of these formats
 		VkShaderModule vertex = shader::load_module_from_file("res/vertex.spv");
 		VkShaderModule fragment = shader::load_module_from_file("res/fragment.spv");
 		VkExtent2D swapchain_extent = context::get_swapchain().extent;
-		pipeline_builder.set_viewport(0.0f, 0.0f, (float)swapchain_extent.width, (float)swapchain_extent.height);
-		pipeline_builder.set_vertex_shader(vertex);
-		pipeline_builder.set_fragment_shader(fragment);
-		pipeline_builder.push_constant<p_constant>(VK_SHADER_STAGE_VERTEX_BIT, 0);
-		pipeline_builder.build(&m_pipeline, &m_layout);
-
-		vkDestroyShaderModule(context::get_device(), vertex, NULL);
-		vkDestroyShaderModule(context::get_device(), fragment, NULL);
 
+		pipeline_builder builder{ std::vector<VkFormat>{ color_format }, m_depth_buffer_format };
+		builder.buffer_layout_push_floats(3);
+		builder.set_viewport(0.0f, 0.0f, (float)swapchain_extent.width, (float)swapchain_extent.height);
+		builder.set_vertex_shader(vertex);
+		builder.set_fragment_shader(fragment);
+		builder.set_depth_test(true);
+		if (m_depth_prepass) {
+			// the pre-pass wrote the final depth, only the visible fragments pass
+			builder.set_depth_compare_op(VK_COMPARE_OP_EQUAL);
+			builder.set_depth_write(false);
+		}
+		builder.push_constant<p_constant>(VK_SHADER_STAGE_VERTEX_BIT, 0);
+		builder.build(&m_pipeline, &m_layout);
+
+		// the vertex shader only reads positions, so it is used for the pre-pass as is. Different pipelines only
+		// compute the same depth, which EQUAL relies on, because the shader declares gl_Position invariant
+		if (m_depth_prepass) {
+			pipeline_builder prepass_builder{ std::vector<VkFormat>{}, m_depth_buffer_format };
+			prepass_builder.buffer_layout_push_floats(3);
+			prepass_builder.set_viewport(0.0f, 0.0f, (float)swapchain_extent.width, (float)swapchain_extent.height);
+			prepass_builder.set_vertex_shader(vertex);
+			prepass_builder.set_depth_only(true);
+			prepass_builder.set_depth_test(true);
+			prepass_builder.push_constant<p_constant>(VK_SHADER_STAGE_VERTEX_BIT, 0);
+			prepass_builder.build(&m_prepass_pipeline, &m_prepass_layout);
+		}
+
+		shader::destroy_module(vertex);
+		shader::destroy_module(fragment);
+
+		// the graph is sized for the swapchain. It is built once the swapchain images are ready and rebuilt
+		// whenever the swapchain is recreated
+		context::set_framebuffer_change_callback([this]() {
+			m_render_graph.destroy();
+			if (!build_render_graph())
+				m_running = false;
+		});
 
 		float data[] = {
 		-0.5f, -0.5f, 0.0f,
@@ -48,99 +75,183 @@ class sandbox_app : public application {
 		};
 		uint32_t indices[] = { 0, 1, 2, 0, 2, 3 };
 
-		command_buffer transfer_cmd_buf;
-		std::shared_ptr<staging_buffer> staging_buf = staging_buffer::create();
+		// the copies are submitted together with the first frame
 		vbo = vertex_buffer::create();
 		ibo = index_buffer::create();
-		transfer_cmd_buf.start();
-		vbo->set_buffer_data(transfer_cmd_buf, staging_buf, data, sizeof(data));
-		ibo->set_buffer_data(transfer_cmd_buf, staging_buf, indices, sizeof(indices));
-		transfer_cmd_buf.end();
-		transfer_cmd_buf.submit(context::get_graphics_queue());
-		vkQueueWaitIdle(context::get_graphics_queue());
-		staging_buf->destroy();
-		transfer_cmd_buf.destroy();
+		vbo->set_buffer_data(m_staging_buffer, data, sizeof(data));
+		ibo->set_buffer_data(m_staging_buffer, indices, sizeof(indices));
 
 		return true;
 	}
 
-	bool on_update(command_buffer& cmd_buf, float delta_time) override {
-		VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE;
-
-		VkClearValue clear_value = { 0.1f, 0.1f, 0.1f, 1.0f };
-
-		VkRenderPassBeginInfo render_pass_begin_info = {};
-		render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		render_pass_begin_info.pNext = NULL;
-		render_pass_begin_info.renderPass = m_render_pass;
-		render_pass_begin_info.framebuffer = context::get_current_framebuffer().get_handle();
-		render_pass_begin_info.clearValueCount = 1;
-		render_pass_begin_info.pClearValues = &clear_value;
-		render_pass_begin_info.renderArea.offset = { 0, 0 };
-		VkExtent2D swapchain_extent = context::get_swapchain().extent;
-		render_pass_begin_info.renderArea.extent = swapchain_extent;
-
-		VkDeviceSize offset = 0;
-		vkCmdBeginRenderPass(cmd_buf.get_handle(), &render_pass_begin_info, contents);
-		vkCmdBindPipeline(cmd_buf.get_handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
-
-
-		
-
+	bool build_render_graph() {
+		VkExtent2D extent = context::get_swapchain().extent;
+		VkFormat color_format = context::get_surface().surface_format.format;
+		// the acquire semaphore is waited for at the color attachment output stage
+		VkImageLayout final_layout = context::is_headless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		m_swapchain_image = m_render_graph.import_image("swapchain", { extent.width, extent.height, color_format },
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, final_layout);
+		m_render_graph.set_output(m_swapchain_image);
+
+		// transient, so it is recreated with the graph when the swapchain changes
+		render_graph::resource_handle depth = m_render_graph.create_image("depth", { extent.width, extent.height, m_depth_buffer_format });
+		if (m_depth_prepass) {
+			m_render_graph.add_pass("depth prepass")
+				.write_depth_stencil(depth)
+				.set_execute([this](command_buffer& cmd_buf, const render_graph::pass_context& pass) {
+					record_depth_prepass(cmd_buf, pass);
+				});
+		}
+
+		VkClearColorValue clear_color = { { 0.1f, 0.1f, 0.1f, 1.0f } };
+		render_graph::pass& main_pass = m_render_graph.add_pass("main pass")
+			.write_color(m_swapchain_image, VK_ATTACHMENT_LOAD_OP_CLEAR, clear_color)
+			.use_secondary_command_buffers()
+			.set_execute([this](command_buffer& cmd_buf, const render_graph::pass_context& pass) {
+				m_pass_success = record_scene(cmd_buf, pass);
+			});
+		if (m_depth_prepass)
+			main_pass.read_depth_stencil(depth);
+		else
+			main_pass.write_depth_stencil(depth);
+		return m_render_graph.compile();
+	}
 
-		vkCmdBindIndexBuffer(cmd_buf.get_handle(), ibo->get_handle(), 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindVertexBuffers(cmd_buf.get_handle(), 0, 1, &vbo->get_handle(), &offset);
+	glm::mat4 view_projection_matrix(VkExtent2D extent) const {
+		glm::mat4 projection_matrix = glm::perspective(3.14159f / 2.0f, (float)extent.width / extent.height, 0.01f, 1000.0f);
+		projection_matrix[1][1] = -projection_matrix[1][1];
+		glm::mat4 view_matrix = glm::mat4(1.0f);
+		return projection_matrix * view_matrix;
+	}
 
-		// set scissors and viewport
+	void set_viewport_and_scissor(command_buffer& cmd_buf, VkExtent2D extent) {
 		VkViewport viewport{};
 		viewport.x = 0.0f;
 		viewport.y = 0.0f;
-		viewport.width = (float)render_pass_begin_info.renderArea.extent.width;
-		viewport.height = (float)render_pass_begin_info.renderArea.extent.height;
+		viewport.width = (float)extent.width;
+		viewport.height = (float)extent.height;
 		viewport.minDepth = 0.0f;
 		viewport.maxDepth = 1.0f;
 
 		VkRect2D scissor;
 		scissor.offset = { 0, 0 };
-		scissor.extent = render_pass_begin_info.renderArea.extent;
+		scissor.extent = extent;
 
 		vkCmdSetViewport(cmd_buf.get_handle(), 0, 1, &viewport);
 		vkCmdSetScissor(cmd_buf.get_handle(), 0, 1, &scissor);
+	}
 
+	// only depth, so the main pass shades every pixel once
+	void record_depth_prepass(command_buffer& cmd_buf, const render_graph::pass_context& pass) {
+		profiler::gpu_scope gpu_scope(m_profiler, cmd_buf, "depth prepass");
+		VkDeviceSize offset = 0;
+		vkCmdBindPipeline(cmd_buf.get_handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_prepass_pipeline);
+		vkCmdBindIndexBuffer(cmd_buf.get_handle(), ibo->get_handle(), 0, VK_INDEX_TYPE_UINT32);
+		vkCmdBindVertexBuffers(cmd_buf.get_handle(), 0, 1, &vbo->get_handle(), &offset);
+		set_viewport_and_scissor(cmd_buf, pass.extent);
 
 		p_constant constants;
-		glm::mat4 projection_matrix = glm::perspective(3.14159f / 2.0f, (float)swapchain_extent.width / swapchain_extent.height, 0.01f, 1000.0f);
-		projection_matrix[1][1] = -projection_matrix[1][1];
-		glm::mat4 view_matrix = glm::mat4(1.0f);
-		constants.view_projection_matrix = projection_matrix * view_matrix;
-		constants.model_matrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -get_time()));
-
-		// draw call
-		vkCmdPushConstants(cmd_buf.get_handle(), m_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
-		vkCmdDrawIndexed(cmd_buf.get_handle(), ibo->index_count(), 1, 0, 0, 0);
-		
-		constants.model_matrix = glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, 0.0f, -5.0f)) * glm::rotate(glm::mat4(1.0f), get_time(), glm::vec3(1.0f, 1.0f, 0.0f));
-		vkCmdPushConstants(cmd_buf.get_handle(), m_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
-		vkCmdDrawIndexed(cmd_buf.get_handle(), ibo->index_count(), 1, 0, 0, 0);
-
-
+		constants.view_projection_matrix = view_projection_matrix(pass.extent);
+		for (const glm::mat4& model_matrix : m_model_matrices) {
+			constants.model_matrix = model_matrix;
+			vkCmdPushConstants(cmd_buf.get_handle(), m_prepass_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+			vkCmdDrawIndexed(cmd_buf.get_handle(), ibo->index_count(), 1, 0, 0, 0);
+		}
+	}
 
+	// the draws are recorded into secondary command buffers by the workers
+	bool record_scene(command_buffer& cmd_buf, const render_graph::pass_context& pass) {
+		profiler::gpu_scope gpu_scope(m_profiler, cmd_buf, "main pass");
+		VkExtent2D extent = pass.extent;
+		glm::mat4 view_projection = view_projection_matrix(extent);
+
+		// the secondaries continue the dynamic rendering of the pass
+		VkCommandBufferInheritanceRenderingInfo rendering_inheritance = {};
+		rendering_inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+		rendering_inheritance.pNext = NULL;
+		rendering_inheritance.flags = 0;
+		rendering_inheritance.viewMask = 0;
+		rendering_inheritance.colorAttachmentCount = pass.color_format_count;
+		rendering_inheritance.pColorAttachmentFormats = pass.color_formats;
+		rendering_inheritance.depthAttachmentFormat = pass.depth_format;
+		rendering_inheritance.stencilAttachmentFormat = has_stencil_component(pass.depth_format) ? pass.depth_format : VK_FORMAT_UNDEFINED;
+		rendering_inheritance.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkCommandBufferInheritanceInfo inheritance = {};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.pNext = &rendering_inheritance;
+		inheritance.renderPass = VK_NULL_HANDLE;
+		inheritance.subpass = 0;
+		inheritance.framebuffer = VK_NULL_HANDLE;
+
+		// one job per object. Larger scenes would give every job a range of objects
+		std::vector<command_allocator::record_job> jobs;
+		for (const glm::mat4& model_matrix : m_model_matrices) {
+			jobs.push_back([&, model_matrix](command_buffer& secondary) {
+				VkDeviceSize offset = 0;
+				vkCmdBindPipeline(secondary.get_handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+				vkCmdBindIndexBuffer(secondary.get_handle(), ibo->get_handle(), 0, VK_INDEX_TYPE_UINT32);
+				vkCmdBindVertexBuffers(secondary.get_handle(), 0, 1, &vbo->get_handle(), &offset);
+
+				set_viewport_and_scissor(secondary, extent);
+
+				// draw call
+				p_constant constants;
+				constants.view_projection_matrix = view_projection;
+				constants.model_matrix = model_matrix;
+				vkCmdPushConstants(secondary.get_handle(), m_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+				vkCmdDrawIndexed(secondary.get_handle(), ibo->index_count(), 1, 0, 0, 0);
+			});
+		}
+		return m_command_allocator.record_parallel(m_thread_pool, cmd_buf, inheritance, jobs);
+	}
 
-		vkCmdEndRenderPass(cmd_buf.get_handle());
+	bool on_update(command_buffer& cmd_buf, float delta_time) override {
+		m_model_matrices[0] = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -get_time()));
+		m_model_matrices[1] = glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, 0.0f, -5.0f)) * glm::rotate(glm::mat4(1.0f), get_time(), glm::vec3(1.0f, 1.0f, 0.0f));
 
-		return true;
+		m_render_graph.set_image(m_swapchain_image, context::get_current_image(), context::get_current_image_view());
+		m_pass_success = true;
+		m_render_graph.execute(cmd_buf);
+		return m_pass_success;
 	}
 
 	void on_terminate() override {
+		if (context::is_headless()) {
+			save_last_frame("frame.ppm");
+			m_profiler.write_chrome_trace("trace.json");
+		}
+		m_render_graph.destroy();
 		vbo->destroy();
 		ibo->destroy();
-		vkDestroyPipelineLayout(context::get_device(), m_layout, NULL);
-		vkDestroyPipeline(context::get_device(), m_pipeline, NULL);
-		vkDestroyRenderPass(context::get_device(), m_render_pass, NULL);
 	}
-private:
+	// writes the image of the last frame as a binary ppm
+	void save_last_frame(const char* path) {
+		VkExtent2D extent = context::get_swapchain().extent;
+		std::vector<uint8_t> pixels((size_t)extent.width * extent.height * 4);
+		if (!read_back_image(context::get_swapchain().images[context::current_image_index()], extent, 4, pixels.data()))
+			return;
+		FILE* file = fopen(path, "wb");
+		if (file == NULL)
+			return;
+		fprintf(file, "P6\n%u %u\n255\n", extent.width, extent.height);
+		for (size_t i = 0; i < pixels.size(); i += 4)
+			fwrite(&pixels[i], 1, 3, file);
+		fclose(file);
+	}
+
 	VkPipelineLayout m_layout;
 	VkPipeline m_pipeline;
+	// the main pass shades with VK_COMPARE_OP_EQUAL after a depth only pass
+	bool m_depth_prepass = true;
+	VkPipelineLayout m_prepass_layout = VK_NULL_HANDLE;
+	VkPipeline m_prepass_pipeline = VK_NULL_HANDLE;
+	VkFormat m_depth_buffer_format = VK_FORMAT_UNDEFINED;
+	glm::mat4 m_model_matrices[2];
+
+	render_graph m_render_graph;
+	render_graph::resource_handle m_swapchain_image = render_graph::INVALID_RESOURCE;
+	bool m_pass_success = true;
 
 	std::shared_ptr<vertex_buffer> vbo;
 	std::shared_ptr<index_buffer> ibo;